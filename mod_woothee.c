@@ -25,6 +25,33 @@
  * Syntax is:
  *
  *   WootheeEnable On
+ *   WootheeExclude /static/ /img/ *.js
+ *   WootheeClientHints On
+ *   WootheeAcceptClientHints On
+ *
+ *   WootheeCrawlerRateLimit name|category req/s burst
+ *   WootheeRoute name|category|* route
+ *   WootheeRouteEnv varname
+ *   WootheeCacheKey header
+ *   WootheeStatus On|Off|Rules
+ *   WootheeSlowLog usec
+ *   WootheeAdaptiveOrder On
+ *   WootheeDisableGroups group [group] ...
+ *   WootheeTopUserAgents k
+ *   WootheeTrustUpstream header-prefix CIDR [CIDR] ...
+ *
+ *   <If "%{WOOTHEE_VERSION} -wver_ge '100'">
+ *
+ *   RewriteMap woothee int:woothee_category
+ *   RewriteCond ${woothee:%{HTTP_USER_AGENT}} =smartphone
+ *
+ *   <Location /woothee-status>
+ *     SetHandler woothee-status
+ *   </Location>
+ *
+ *   Require woothee-crawler
+ *   Require woothee-category category [category] ...
+ *   Require woothee-name name [name] ...
  *
  *   RequestHeaderForWootheeEnable On
  *   RequestHeaderForWoothee action header item
@@ -38,12 +65,19 @@
  *              avoiding duplicate values
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "apr.h"
 #include "apr_lib.h"
 #include "apr_strings.h"
 #include "apr_buckets.h"
 
 #include "apr_hash.h"
+#include "apr_shm.h"
+#include "apr_atomic.h"
+#include "apr_global_mutex.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 
@@ -53,10 +87,21 @@
 #include "http_log.h"
 #include "http_protocol.h"
 #include "ap_expr.h"
+#include "util_filter.h"
+#include "ap_mpm.h"
+#include "scoreboard.h"
+#include "mod_status.h"
+#include "util_mutex.h"
+#include "ap_provider.h"
+#include "mod_auth.h"
 
 #include "mod_ssl.h" /* for the ssl_var_lookup optional function defn */
+#include "mod_rewrite.h" /* for the ap_register_rewrite_mapfunc defn */
 
 #include "woothee.h"
+#include "probes.h"
+
+#include <math.h>
 
 typedef enum {
   hdr_add = 'a',              /* add header (could mean multiple hdrs) */
@@ -72,6 +117,9 @@ typedef enum {
  */
 static char hdr_in  = '0';
 
+/* Default environment variable set by WootheeRoute */
+static const char *route_env_default = "WOOTHEE_ROUTE";
+
 /* 'Magic' condition_var value to run action in post_read_request */
 static const char* condition_early = "early";
 /*
@@ -86,6 +134,25 @@ typedef struct {
   ap_expr_info_t *expr;
 } header_entry;
 
+/*
+ * WootheeExclude patterns are compiled into two tries: prefix patterns
+ * ("/static/") as written and suffix patterns ("*.js") reversed, so a
+ * single walk from either end of the URI decides the match.
+ */
+typedef struct woothee_trie_node woothee_trie_node;
+struct woothee_trie_node {
+  woothee_trie_node *child;
+  woothee_trie_node *sibling;
+  unsigned char c;
+  int terminal;
+};
+
+typedef struct {
+  apr_array_header_t *patterns;
+  woothee_trie_node *prefix;
+  woothee_trie_node *suffix;
+} woothee_exclude;
+
 /*
  * woothee_conf is our per-module configuration. This is used as both
  * a per-dir and per-server config
@@ -93,9 +160,175 @@ typedef struct {
 typedef struct {
   int notes_enable;
   int header_enable;
+  int client_hints;                 /* -1 when unset, inherited */
+  int accept_client_hints;
   apr_array_header_t *fixup_in;
+  unsigned int header_fields;       /* WOOTHEE_FIELD_* of fixup_in items */
+  woothee_exclude *exclude;
+  apr_hash_t *routes;
+  const char *route_env;
+  const char *cache_key;
+  const char *upstream_prefix;      /* WootheeTrustUpstream */
+  apr_array_header_t *upstream_ips; /* apr_ipsubnet_t * */
 } woothee_conf;
 
+/*
+ * Sec-CH-UA brands mapped to the browser woothee_parse() reports for the
+ * same User-Agent; Chromium based browsers other than Opera are Chrome.
+ */
+typedef struct {
+  const char *brand;
+  woothee_data_t *data;
+  int rank;
+} woothee_brand;
+
+static woothee_brand woothee_brands[] = {
+  { "Opera", woothee_dataset_get(Opera), 2 },
+  { "Google Chrome", woothee_dataset_get(Chrome), 1 },
+  { "Chromium", woothee_dataset_get(Chrome), 1 },
+  { NULL, NULL, 0 }
+};
+
+/*
+ * WootheeCrawlerRateLimit: one GCRA bucket per dataset entry. interval is
+ * the emission interval in msec and burst the number of requests that
+ * may arrive at once.
+ */
+typedef struct {
+  apr_uint32_t interval;
+  apr_uint32_t burst;
+  int specific;
+} woothee_ratelimit;
+
+/*
+ * woothee_server_conf is the per-server configuration, for settings
+ * shared by all requests of the server
+ */
+typedef struct {
+  woothee_ratelimit *ratelimits;
+  int status;                    /* WOOTHEE_STATUS_* */
+  int adaptive_order;
+  unsigned int disabled_groups;  /* WootheeDisableGroups */
+  int topk;                      /* WootheeTopUserAgents, 0 when disabled */
+  apr_interval_time_t slow_usec; /* WootheeSlowLog, 0 when disabled */
+  unsigned int parse_fields;     /* WOOTHEE_FIELD_* used by this server */
+} woothee_server_conf;
+
+/*
+ * WootheeStatus counters. There is one slot per scoreboard worker (child
+ * and thread), written only by requests that worker thread runs, so the
+ * plain increments never race; slots are summed when woothee-status is
+ * read. Requests run by any other thread (HTTP/2 streams) are not
+ * counted, see woothee_worker_sbh(). A slot is this struct followed by
+ * the per name counters and the per challenge rule stats.
+ */
+#define WOOTHEE_LATENCY_BUCKETS 18 /* <= 2^0 .. 2^16 usec, +Inf */
+
+/* WootheeStatus, Rules adds the time spent in each challenge rule */
+#define WOOTHEE_STATUS_OFF   0
+#define WOOTHEE_STATUS_ON    1
+#define WOOTHEE_STATUS_RULES 2
+
+typedef struct {
+  apr_uint64_t requests;
+  apr_uint64_t excluded;
+  apr_uint64_t parses;
+  apr_uint64_t client_hints;
+  apr_uint64_t upstream;
+  apr_uint64_t cache_hits;
+  apr_uint64_t cache_misses;
+  apr_uint64_t parse_usec;
+  apr_uint64_t latency[WOOTHEE_LATENCY_BUCKETS];
+  apr_uint64_t categories[WOOTHEE_CATEGORY_SIZE];
+} woothee_stats;
+
+static char *status_slots = NULL;
+static apr_size_t status_slot_size = 0;
+static apr_size_t status_rules_offset = 0;
+static int status_thread_limit = 0;
+static int status_nslots = 0;
+static int status_rule_timing = 0;
+
+/*
+ * WootheeAdaptiveOrder challenge orders of this child, one per worker
+ * thread since an order is updated by each parse.
+ */
+#define WOOTHEE_ORDER_PERIOD 1024
+
+static woothee_order_t **adaptive_orders = NULL;
+static int adaptive_threads = 0;
+
+/*
+ * WootheeTopUserAgents sketch: Space-Saving counters of the k most
+ * frequent User-Agents and a HyperLogLog of the distinct ones, in a fixed
+ * size shared memory segment. Longer User-Agents are truncated.
+ *
+ * The entries are a min-heap on count, so the one to replace is the
+ * first, and are found by hash through an open addressing index of at
+ * least 2k slots that follows them.
+ */
+#define WOOTHEE_TOPK_UA_LEN 256
+#define WOOTHEE_HLL_BITS 12
+#define WOOTHEE_HLL_REGISTERS (1 << WOOTHEE_HLL_BITS)
+
+typedef struct {
+  apr_uint64_t hash;
+  apr_uint64_t count;
+  apr_uint64_t error; /* count overestimate, from the entry replaced */
+  apr_uint32_t slot;  /* its index slot */
+  char ua[WOOTHEE_TOPK_UA_LEN];
+} woothee_topk_entry;
+
+typedef struct {
+  apr_uint32_t hll[WOOTHEE_HLL_REGISTERS]; /* updated without the mutex */
+  apr_uint32_t size;                        /* entries in use */
+  apr_uint32_t mask;                        /* index slots - 1 */
+  woothee_topk_entry entries[1];            /* WootheeTopUserAgents */
+  /* apr_uint32_t index[mask + 1], entry position + 1 or 0 when free */
+} woothee_topk;
+
+static const char *topk_mutex_type = "woothee-topk";
+static apr_global_mutex_t *topk_mutex = NULL;
+static woothee_topk *topk = NULL;
+static int topk_k = 0;
+
+/*
+ * Fields the User-Agent is parsed for: those of the server's configuration
+ * and of any %{WOOTHEE_*} expression, which is not tied to a server.
+ * The library finds name, category, os and vendor in any case, only the
+ * version regexes can be skipped.
+ */
+#define WOOTHEE_FIELD_BASE                                      \
+  (WOOTHEE_FIELD_NAME | WOOTHEE_FIELD_CATEGORY | WOOTHEE_FIELD_OS   \
+   | WOOTHEE_FIELD_VENDOR)
+static unsigned int expr_fields = 0;
+
+/* dataset name -> index, built at startup and read only afterwards */
+static apr_hash_t *dataset_names = NULL;
+
+/*
+ * Theoretical arrival times in msec since ratelimit_epoch, one per
+ * dataset entry, in shared memory so that all children see them.
+ */
+static volatile apr_uint32_t *ratelimit_tat = NULL;
+static apr_time_t ratelimit_epoch = 0;
+
+/*
+ * Per-request woothee result, shared by the early and late fixups and the
+ * authorization providers so a request is parsed at most once per
+ * WootheeClientHints setting.
+ */
+typedef struct {
+  woothee_t *woothee;
+  apr_interval_time_t parse_usec; /* -1 unless the User-Agent was parsed */
+  int client_hints;               /* WootheeClientHints it was made with */
+  unsigned int fields;            /* WOOTHEE_FIELD_* woothee was made for */
+} woothee_request;
+
+/* High entropy hints requested by WootheeAcceptClientHints */
+static const char *accept_client_hints =
+  "Sec-CH-UA-Platform-Version, Sec-CH-UA-Full-Version-List";
+
 module AP_MODULE_DECLARE_DATA woothee_module;
 
 /* Pointer to ssl_var_lookup, if available. */
@@ -103,379 +336,2636 @@ static APR_OPTIONAL_FN_TYPE(ssl_var_lookup) *header_ssl_lookup = NULL;
 
 
 /*
- * Config routines
+ * Exclude routines
  */
 
-static void *
-create_woothee_dir_config(apr_pool_t *p, char *d)
+static woothee_exclude *
+woothee_exclude_create(apr_pool_t *p)
 {
-  woothee_conf *conf = apr_pcalloc(p, sizeof(*conf));
+  woothee_exclude *exclude = apr_pcalloc(p, sizeof(*exclude));
 
-  conf->notes_enable = 0;
-  conf->header_enable = 0;
-  conf->fixup_in = apr_array_make(p, 2, sizeof(header_entry));
+  exclude->patterns = apr_array_make(p, 4, sizeof(const char *));
+  exclude->prefix = apr_pcalloc(p, sizeof(woothee_trie_node));
+  exclude->suffix = apr_pcalloc(p, sizeof(woothee_trie_node));
 
-  return conf;
+  return exclude;
 }
 
-static void *
-merge_woothee_config(apr_pool_t *p, void *basev, void *overridesv)
+static void
+woothee_trie_insert(apr_pool_t *p, woothee_trie_node *node,
+                    const char *str, apr_size_t len, int reverse)
 {
-  woothee_conf *newconf = apr_pcalloc(p, sizeof(*newconf));
-  woothee_conf *base = basev;
-  woothee_conf *overrides = overridesv;
+  apr_size_t i;
 
-  newconf->notes_enable = overrides->notes_enable;
-  newconf->header_enable = overrides->header_enable;
-  newconf->fixup_in = apr_array_append(p, base->fixup_in,
-                                       overrides->fixup_in);
+  for (i = 0; i < len; i++) {
+    unsigned char c = reverse ? str[len - i - 1] : str[i];
+    woothee_trie_node *next = node->child;
 
-  return newconf;
+    while (next && next->c != c) {
+      next = next->sibling;
+    }
+    if (!next) {
+      next = apr_pcalloc(p, sizeof(*next));
+      next->c = c;
+      next->sibling = node->child;
+      node->child = next;
+    }
+    node = next;
+  }
+
+  node->terminal = 1;
 }
 
-/* handle RequestHeader and Header directive */
-static APR_INLINE const char *
-header_inout_cmd(cmd_parms *cmd, void *indirconf,
-                 const char *action, const char *hdr,
-                 const char *value, const char *subs, const char *envclause)
+static const char *
+woothee_exclude_add(apr_pool_t *p, woothee_exclude *exclude,
+                    const char *pattern)
 {
-  woothee_conf *dirconf = indirconf;
-  const char *condition_var = NULL;
-  const char *colon;
-  header_entry *new;
-  ap_expr_info_t *expr = NULL;
-
-  apr_array_header_t *fixup = dirconf->fixup_in;
-
-  new = (header_entry *) apr_array_push(fixup);
-
-  if (!strcasecmp(action, "set")) {
-    new->action = hdr_set;
-  } else if (!strcasecmp(action, "setifempty")) {
-    new->action = hdr_setifempty;
-  } else if (!strcasecmp(action, "add")) {
-    new->action = hdr_add;
-  } else if (!strcasecmp(action, "append")) {
-    new->action = hdr_append;
-  } else if (!strcasecmp(action, "merge")) {
-    new->action = hdr_merge;
-  } else if (!strcasecmp(action, "note")) {
-    new->action = hdr_note;
+  const char *source = pattern;
+  apr_size_t len = strlen(pattern);
+
+  if (*pattern == '*') {
+    pattern++;
+    len--;
+    if (len == 0 || memchr(pattern, '*', len)) {
+      return "suffix pattern must be in the form *suffix";
+    }
+    woothee_trie_insert(p, exclude->suffix, pattern, len, 1);
   } else {
-    return "first argument must be 'add', 'set', 'setifempty', 'append', "
-      "'merge', 'note'.";
+    if (len > 0 && pattern[len - 1] == '*') {
+      len--;
+    }
+    if (len == 0 || memchr(pattern, '*', len)) {
+      return "prefix pattern must be in the form prefix or prefix*";
+    }
+    woothee_trie_insert(p, exclude->prefix, pattern, len, 0);
   }
 
-  /* there's no subs, so envclause is really that argument */
-  if (envclause != NULL) {
-    return "Too many arguments to directive";
-  }
-  envclause = subs;
+  *(const char **)apr_array_push(exclude->patterns) = source;
 
-  if (!value) {
-    return "Header requires three arguments";
-  }
+  return NULL;
+}
 
-  /* Handle the envclause on Header */
-  if (envclause != NULL) {
-    if (strcasecmp(envclause, "early") == 0) {
-      condition_var = condition_early;
-    } else if (strncasecmp(envclause, "env=", 4) == 0) {
-      if ((envclause[4] == '\0')
-          || ((envclause[4] == '!') && (envclause[5] == '\0'))) {
-        return "error: missing environment variable name. "
-          "envclause should be in the form env=envar ";
-      }
-      condition_var = envclause + 4;
-    } else if (strncasecmp(envclause, "expr=", 5) == 0) {
-      const char *err = NULL;
-      expr = ap_expr_parse_cmd(cmd, envclause + 5, 0, &err, NULL);
-      if (err) {
-        return apr_pstrcat(cmd->pool,
-                           "Can't parse envclause/expression: ", err, NULL);
-      }
+static int
+woothee_trie_match(const woothee_trie_node *node,
+                   const char *str, apr_size_t len, int reverse)
+{
+  apr_size_t i;
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = reverse ? str[len - i - 1] : str[i];
+
+    node = node->child;
+    while (node && node->c != c) {
+      node = node->sibling;
     }
-    else {
-      return apr_pstrcat(cmd->pool, "Unknown parameter: ", envclause, NULL);
+    if (!node) {
+      return 0;
+    }
+    if (node->terminal) {
+      return 1;
     }
   }
 
-  if ((colon = ap_strchr_c(hdr, ':'))) {
-    hdr = apr_pstrmemdup(cmd->pool, hdr, colon-hdr);
-  }
+  return 0;
+}
 
-  new->header = hdr;
-  new->condition_var = condition_var;
-  new->expr = expr;
+static int
+woothee_excluded(const woothee_exclude *exclude, const char *uri)
+{
+  apr_size_t len;
 
-  new->item = apr_pstrcat(cmd->pool, value, NULL);
+  if (!exclude || !uri) {
+    return 0;
+  }
 
-  return NULL;
+  len = strlen(uri);
+
+  return woothee_trie_match(exclude->prefix, uri, len, 0)
+    || woothee_trie_match(exclude->suffix, uri, len, 1);
 }
 
-/* Handle directives */
-static const char *
-notes_set(cmd_parms *cmd, void *indirconf, int arg)
+/*
+ * WootheeExclude check of a request. The post_read_request hooks run
+ * before the core normalizes r->uri, so a normalized copy must match as
+ * well: /static/../page is not excluded by /static/.
+ */
+static int
+woothee_request_excluded(request_rec *r, const woothee_exclude *exclude)
 {
-  woothee_conf *dirconf = indirconf;
+  char *uri;
 
-  dirconf->notes_enable = arg;
+  if (!woothee_excluded(exclude, r->uri)) {
+    return 0;
+  }
 
-  return NULL;
+  uri = apr_pstrdup(r->pool, r->uri);
+#if AP_MODULE_MAGIC_AT_LEAST(20120211, 105)
+  if (!ap_normalize_path(uri, AP_NORMALIZE_NOT_ABOVE_ROOT
+                         | AP_NORMALIZE_DECODE_UNRESERVED
+                         | AP_NORMALIZE_MERGE_SLASHES)) {
+    return 0;
+  }
+#else
+  /* %2e is not decoded here, such a URI is never excluded */
+  if (strchr(uri, '%')) {
+    return 0;
+  }
+  ap_getparents(uri);
+  ap_no2slash(uri);
+#endif
+
+  return woothee_excluded(exclude, uri);
 }
 
+/*
+ * Client Hints routines
+ */
+
+/* parse an RFC 8941 sf-string, advancing *line past it */
 static const char *
-header_set(cmd_parms *cmd, void *indirconf, int arg)
+sf_parse_string(apr_pool_t *p, const char **line)
 {
-  woothee_conf *dirconf = indirconf;
+  const char *s = *line;
+  char *str, *d;
 
-  dirconf->header_enable = arg;
+  if (*s != '"') {
+    return NULL;
+  }
+  s++;
+
+  str = d = apr_palloc(p, strlen(s) + 1);
+  while (*s && *s != '"') {
+    if (*s == '\\') {
+      s++;
+      if (*s != '"' && *s != '\\') {
+        return NULL;
+      }
+    }
+    *d++ = *s++;
+  }
+  if (*s != '"') {
+    return NULL;
+  }
+  *d = '\0';
 
-  return NULL;
+  *line = s + 1;
+
+  return str;
 }
 
+/* parse a header that must hold a single sf-string item */
 static const char *
-header_cmd(cmd_parms *cmd, void *indirconf, const char *args)
+sf_string_header(apr_pool_t *p, apr_table_t *headers, const char *name)
 {
-  const char *action;
-  const char *hdr;
-  const char *val;
-  const char *envclause;
-  const char *subs;
+  const char *val = apr_table_get(headers, name);
+  const char *str;
 
-  action = ap_getword_conf(cmd->temp_pool, &args);
-  hdr = ap_getword_conf(cmd->pool, &args);
-  val = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
-  subs = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
-  envclause = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
+  if (!val) {
+    return NULL;
+  }
 
-  if (*args) {
-    return apr_pstrcat(cmd->pool, cmd->cmd->name,
-                       " has too many arguments", NULL);
+  while (apr_isspace(*val)) {
+    val++;
+  }
+  str = sf_parse_string(p, &val);
+  while (apr_isspace(*val)) {
+    val++;
   }
 
-  return header_inout_cmd(cmd, indirconf, action, hdr, val, subs, envclause);
+  return (str && *val == '\0') ? str : NULL;
 }
 
 /*
- * Process the item in the woothee struct.
+ * Pick the browser out of a Sec-CH-UA style list:
+ *   "Chromium";v="120", "Not?A_Brand";v="99", "Google Chrome";v="120"
  */
-static char *
-woothee_process_item(header_entry *hdr, request_rec *r, woothee_t *woothee)
+static woothee_data_t *
+client_hints_browser(apr_pool_t *p, const char *list, const char **version)
 {
-  const char *v = NULL;
-  const char *item = NULL;
-  char *str = NULL;
+  woothee_brand *found = NULL;
+  const char *s = list;
 
-  if (!woothee) {
-    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02557)
-                  "Can't evaluate value woothee");
-    return "";
-  }
+  while (*s) {
+    const char *brand, *v = NULL;
+    woothee_brand *b;
 
-  item = (const char *)hdr->item;
+    while (*s == ' ' || *s == '\t') {
+      s++;
+    }
+    brand = sf_parse_string(p, &s);
+    if (!brand) {
+      return NULL;
+    }
 
-  if (item) {
-    if (strcmp(item, "name") == 0) {
-      v = woothee->name;
-    } else if (strcmp(item, "os") == 0) {
-      v = woothee->os;
-    } else if (strcmp(item, "category") == 0) {
-      v = woothee->category;
-    } else if (strcmp(item, "os_version") == 0) {
-      v = woothee->os_version;
-    } else if (strcmp(item, "version") == 0) {
-      v = woothee->version;
-    } else if (strcmp(item, "vendor") == 0) {
-      v = woothee->vendor;
+    while (*s == ';') {
+      const char *key = ++s, *val = NULL;
+      apr_size_t klen;
+
+      while (apr_isalnum(*s) || *s == '_' || *s == '-'
+             || *s == '.' || *s == '*') {
+        s++;
+      }
+      klen = s - key;
+      if (*s == '=') {
+        s++;
+        if (*s == '"') {
+          val = sf_parse_string(p, &s);
+          if (!val) {
+            return NULL;
+          }
+        } else {
+          while (*s && *s != ';' && *s != ',' && *s != ' ') {
+            s++;
+          }
+        }
+      }
+      if (klen == 1 && *key == 'v') {
+        v = val;
+      }
     }
-  }
 
-  if (v) {
-    str = apr_pstrdup(r->pool, v);
+    while (*s == ' ' || *s == '\t') {
+      s++;
+    }
+    if (*s == ',') {
+      s++;
+    } else if (*s) {
+      return NULL;
+    }
+
+    for (b = woothee_brands; b->brand; b++) {
+      if (strcmp(b->brand, brand) == 0) {
+        if (!found || b->rank > found->rank) {
+          found = b;
+          *version = v;
+        }
+        break;
+      }
+    }
   }
 
-  return str ? str : "";
+  return found ? found->data : NULL;
 }
 
-static int
-do_woothee_fixup(request_rec *r, apr_table_t *headers,
-                 apr_array_header_t *fixup, int early)
+static void
+woothee_set(char **field, const char *value)
 {
-  int i;
-  const char *val, *ua;
-  woothee_conf *conf;
-  woothee_t *woothee = NULL;
-
-  ua = apr_table_get(headers, "User-Agent");
-  if (ua != NULL) {
-    woothee = woothee_parse(ua);
+  if (*field) {
+    free(*field);
   }
-  if (!woothee) {
-    return 1;
+  *field = strdup(value ? value : WOOTHEE_DATASET_VALUE_UNKNOWN);
+}
+
+/*
+ * Fill a woothee result from Sec-CH-UA* request headers.
+ * Returns NULL when the hints are missing or not conclusive, in which case
+ * the User-Agent is parsed instead.
+ */
+static woothee_t *
+woothee_client_hints(request_rec *r, apr_table_t *headers)
+{
+  woothee_t *woothee;
+  woothee_data_t *browser, *data = NULL;
+  const char *list, *platform, *platform_version, *mobile;
+  const char *version = NULL, *os_version;
+
+  list = apr_table_get(headers, "Sec-CH-UA-Full-Version-List");
+  if (!list) {
+    list = apr_table_get(headers, "Sec-CH-UA");
+  }
+  if (!list) {
+    return NULL;
+  }
+
+  platform = sf_string_header(r->pool, headers, "Sec-CH-UA-Platform");
+  platform_version = sf_string_header(r->pool, headers,
+                                      "Sec-CH-UA-Platform-Version");
+  if (!platform || !platform_version) {
+    return NULL;
+  }
+
+  browser = client_hints_browser(r->pool, list, &version);
+  if (!browser) {
+    return NULL;
+  }
+
+  os_version = platform_version;
+
+  if (strcmp(platform, "Windows") == 0) {
+    /* platform version 1.0.0 and later is Windows 10 or 11 */
+    char *end;
+    apr_int64_t major = apr_strtoi64(platform_version, &end, 10);
+    apr_int64_t minor = (*end == '.') ? apr_strtoi64(end + 1, NULL, 10) : 0;
+
+    if (major >= 1) {
+      data = woothee_dataset_get(Win10);
+      os_version = "NT 10.0";
+    } else if (minor == 3) {
+      data = woothee_dataset_get(Win8_1);
+      os_version = "NT 6.3";
+    } else if (minor == 2) {
+      data = woothee_dataset_get(Win8);
+      os_version = "NT 6.2";
+    } else if (minor == 1) {
+      data = woothee_dataset_get(Win7);
+      os_version = "NT 6.1";
+    }
+  } else if (strcmp(platform, "macOS") == 0) {
+    data = woothee_dataset_get(OSX);
+  } else if (strcmp(platform, "Android") == 0) {
+    data = woothee_dataset_get(Android);
+  } else if (strcmp(platform, "Linux") == 0) {
+    data = woothee_dataset_get(Linux);
+  } else if (strcmp(platform, "Chrome OS") == 0
+             || strcmp(platform, "Chromium OS") == 0) {
+    data = woothee_dataset_get(ChromeOS);
+  }
+
+  if (!data) {
+    return NULL;
+  }
+
+  woothee = woothee_create();
+  if (!woothee) {
+    return NULL;
+  }
+
+  mobile = apr_table_get(headers, "Sec-CH-UA-Mobile");
+
+  woothee_set(&woothee->name, browser->name);
+  woothee_set(&woothee->vendor, browser->vendor);
+  woothee_set(&woothee->version, version);
+  woothee_set(&woothee->os, data->name);
+  woothee_set(&woothee->os_version, *os_version ? os_version : NULL);
+  if (mobile && strcmp(mobile, "?1") == 0
+      && strcmp(data->category, "pc") == 0) {
+    woothee_set(&woothee->category, "smartphone");
+  } else {
+    woothee_set(&woothee->category, data->category);
+  }
+  woothee_update_numbers(woothee);
+
+  return woothee;
+}
+
+/*
+ * Upstream routines
+ */
+
+/* the RequestHeaderForWoothee items as sent by the front tier */
+static const char *upstream_items[] = {
+  "Name", "Category", "Os", "Os-Version", "Version", "Vendor", NULL
+};
+
+static int
+woothee_upstream_trusted(request_rec *r, woothee_conf *conf)
+{
+  apr_sockaddr_t *addr = r->connection->client_addr;
+  int i;
+
+  for (i = 0; i < conf->upstream_ips->nelts; i++) {
+    if (apr_ipsubnet_test(APR_ARRAY_IDX(conf->upstream_ips, i,
+                                        apr_ipsubnet_t *), addr)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Fill a woothee result from the headers of a trusted front tier.
+ * Returns NULL unless the peer is trusted and sent at least the name and
+ * category headers.
+ */
+static woothee_t *
+woothee_upstream(request_rec *r, woothee_conf *conf)
+{
+  const char *values[6];
+  woothee_t *woothee;
+  int i;
+
+  if (!woothee_upstream_trusted(r, conf)) {
+    return NULL;
+  }
+
+  for (i = 0; upstream_items[i]; i++) {
+    values[i] = apr_table_get(r->headers_in,
+                              apr_pstrcat(r->pool, conf->upstream_prefix,
+                                          upstream_items[i], NULL));
+  }
+  if (!values[0] || !values[1]) {
+    return NULL;
+  }
+
+  woothee = woothee_create();
+  if (!woothee) {
+    return NULL;
+  }
+
+  woothee_set(&woothee->name, values[0]);
+  woothee_set(&woothee->category, values[1]);
+  woothee_set(&woothee->os, values[2]);
+  woothee_set(&woothee->os_version, values[3]);
+  woothee_set(&woothee->version, values[4]);
+  woothee_set(&woothee->vendor, values[5]);
+  woothee_update_numbers(woothee);
+
+  return woothee;
+}
+
+/*
+ * Status routines
+ */
+
+static int
+woothee_name_index(const char *name)
+{
+  const int *index;
+
+  if (!dataset_names || !name) {
+    return -1;
+  }
+
+  index = apr_hash_get(dataset_names, name, APR_HASH_KEY_STRING);
+
+  return index ? *index : -1;
+}
+
+/*
+ * The scoreboard handle of the worker thread running this request, NULL
+ * when another thread may run it: requests of secondary connections
+ * (HTTP/2 streams) run on threads of their own, next to the worker of
+ * their master connection, whose handle they may carry.
+ */
+static const ap_sb_handle_t *
+woothee_worker_sbh(request_rec *r)
+{
+#if AP_MODULE_MAGIC_AT_LEAST(20120211, 52)
+  if (r->connection->master) {
+    return NULL;
+  }
+#endif
+
+  return r->connection->sbh;
+}
+
+/* the counter slot of the worker running this request, NULL for none */
+static woothee_stats *
+woothee_stats_get(request_rec *r)
+{
+  const ap_sb_handle_t *sbh = woothee_worker_sbh(r);
+  int slot;
+
+  if (!status_slots || !sbh || sbh->child_num < 0 || sbh->thread_num < 0
+      || sbh->thread_num >= status_thread_limit) {
+    return NULL;
+  }
+
+  slot = sbh->child_num * status_thread_limit + sbh->thread_num;
+  if (slot >= status_nslots) {
+    return NULL;
+  }
+
+  return (woothee_stats *)(status_slots + slot * status_slot_size);
+}
+
+/* counters per woothee name, woothee_dataset_size() + 1 for UNKNOWN */
+static APR_INLINE apr_uint64_t *
+woothee_stats_names(const woothee_stats *stats)
+{
+  return (apr_uint64_t *)(stats + 1);
+}
+
+static APR_INLINE woothee_rule_stat_t *
+woothee_stats_rules(const woothee_stats *stats)
+{
+  return (woothee_rule_stat_t *)((char *)stats + status_rules_offset);
+}
+
+static void
+woothee_stats_parse(woothee_stats *stats, woothee_t *woothee,
+                    apr_time_t start, apr_time_t end)
+{
+  apr_uint64_t usec = (end > start) ? (apr_uint64_t)(end - start) : 0;
+  int bucket = 0;
+  int index;
+
+  stats->parses++;
+  stats->parse_usec += usec;
+
+  while (bucket < WOOTHEE_LATENCY_BUCKETS - 1
+         && usec > ((apr_uint64_t)1 << bucket)) {
+    bucket++;
+  }
+  stats->latency[bucket]++;
+
+  if (!woothee) {
+    return;
+  }
+
+  stats->categories[woothee_category_id(woothee->category)]++;
+
+  index = woothee_name_index(woothee->name);
+  if (index < 0) {
+    index = woothee_dataset_size();
+  }
+  woothee_stats_names(stats)[index]++;
+}
+
+/*
+ * Top User-Agent routines
+ */
+
+/* FNV-1a with a splitmix64 finalizer, the HyperLogLog needs all 64 bits */
+static apr_uint64_t
+woothee_topk_hash(const char *ua, apr_size_t len)
+{
+  apr_uint64_t h = APR_UINT64_C(0xcbf29ce484222325);
+  apr_size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)ua[i];
+    h *= APR_UINT64_C(0x100000001b3);
+  }
+
+  h ^= h >> 30;
+  h *= APR_UINT64_C(0xbf58476d1ce4e5b9);
+  h ^= h >> 27;
+  h *= APR_UINT64_C(0x94d049bb133111eb);
+  h ^= h >> 31;
+
+  return h;
+}
+
+static void
+woothee_hll_add(apr_uint64_t hash)
+{
+  volatile apr_uint32_t *reg = &topk->hll[hash >> (64 - WOOTHEE_HLL_BITS)];
+  apr_uint64_t w = hash << WOOTHEE_HLL_BITS;
+  apr_uint32_t rank = 1, old;
+
+  while (rank <= 64 - WOOTHEE_HLL_BITS && !(w & APR_UINT64_C(1) << 63)) {
+    w <<= 1;
+    rank++;
+  }
+
+  do {
+    old = apr_atomic_read32(reg);
+    if (old >= rank) {
+      return;
+    }
+  } while (apr_atomic_cas32(reg, rank, old) != old);
+}
+
+static double
+woothee_hll_estimate(void)
+{
+  double m = WOOTHEE_HLL_REGISTERS, sum = 0, estimate;
+  int i, zeros = 0;
+
+  for (i = 0; i < WOOTHEE_HLL_REGISTERS; i++) {
+    apr_uint32_t rank = apr_atomic_read32(&topk->hll[i]);
+    sum += 1.0 / (double)(APR_UINT64_C(1) << rank);
+    if (rank == 0) {
+      zeros++;
+    }
+  }
+
+  estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+  /* linear counting for small cardinalities */
+  if (estimate <= 2.5 * m && zeros) {
+    estimate = m * log(m / zeros);
+  }
+
+  return estimate;
+}
+
+static APR_INLINE apr_uint32_t *
+woothee_topk_index(void)
+{
+  return (apr_uint32_t *)&topk->entries[topk_k];
+}
+
+/* swap two heap positions, keeping the index pointing at them */
+static void
+woothee_topk_swap(apr_uint32_t *index, apr_uint32_t i, apr_uint32_t j)
+{
+  woothee_topk_entry tmp = topk->entries[i];
+
+  topk->entries[i] = topk->entries[j];
+  topk->entries[j] = tmp;
+  index[topk->entries[i].slot] = i + 1;
+  index[topk->entries[j].slot] = j + 1;
+}
+
+static void
+woothee_topk_sift_down(apr_uint32_t *index, apr_uint32_t i)
+{
+  woothee_topk_entry *entries = topk->entries;
+  apr_uint32_t child;
+
+  while ((child = 2 * i + 1) < topk->size) {
+    if (child + 1 < topk->size
+        && entries[child + 1].count < entries[child].count) {
+      child++;
+    }
+    if (entries[i].count <= entries[child].count) {
+      break;
+    }
+    woothee_topk_swap(index, i, child);
+    i = child;
+  }
+}
+
+static void
+woothee_topk_sift_up(apr_uint32_t *index, apr_uint32_t i)
+{
+  while (i > 0
+         && topk->entries[(i - 1) / 2].count > topk->entries[i].count) {
+    woothee_topk_swap(index, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+/* free an index slot, moving back the entries probed past it */
+static void
+woothee_topk_unindex(apr_uint32_t *index, apr_uint32_t slot)
+{
+  apr_uint32_t next = slot, home;
+
+  for (;;) {
+    next = (next + 1) & topk->mask;
+    if (!index[next]) {
+      break;
+    }
+    home = (apr_uint32_t)topk->entries[index[next] - 1].hash & topk->mask;
+    /* unless its home slot lies cyclically in (slot, next] */
+    if (((next - home) & topk->mask) >= ((next - slot) & topk->mask)) {
+      index[slot] = index[next];
+      topk->entries[index[slot] - 1].slot = slot;
+      slot = next;
+    }
+  }
+
+  index[slot] = 0;
+}
+
+/*
+ * Count the User-Agent. The sketch is skipped when another worker holds
+ * the mutex, so requests never wait on it; counts are then a sample.
+ */
+static void
+woothee_topk_add(const char *ua)
+{
+  woothee_topk_entry *entry;
+  apr_uint32_t *index;
+  apr_size_t len = strlen(ua);
+  apr_uint64_t hash;
+  apr_uint32_t slot, i;
+
+  if (len >= WOOTHEE_TOPK_UA_LEN) {
+    len = WOOTHEE_TOPK_UA_LEN - 1;
+  }
+  hash = woothee_topk_hash(ua, len);
+
+  woothee_hll_add(hash);
+
+  if (apr_global_mutex_trylock(topk_mutex) != APR_SUCCESS) {
+    return;
+  }
+
+  index = woothee_topk_index();
+
+  for (slot = (apr_uint32_t)hash & topk->mask; index[slot];
+       slot = (slot + 1) & topk->mask) {
+    i = index[slot] - 1;
+    entry = &topk->entries[i];
+    if (entry->hash == hash && strncmp(entry->ua, ua, len) == 0
+        && entry->ua[len] == '\0') {
+      entry->count++;
+      woothee_topk_sift_down(index, i);
+      apr_global_mutex_unlock(topk_mutex);
+      return;
+    }
+  }
+
+  if (topk->size < (apr_uint32_t)topk_k) {
+    i = topk->size++;
+    entry = &topk->entries[i];
+    entry->count = 1;
+    entry->error = 0;
+  }
+  else {
+    /* replace the least counted, inheriting its count as the error */
+    i = 0;
+    entry = &topk->entries[0];
+    woothee_topk_unindex(index, entry->slot);
+    entry->error = entry->count;
+    entry->count++;
+    slot = (apr_uint32_t)hash & topk->mask;
+    while (index[slot]) {
+      slot = (slot + 1) & topk->mask;
+    }
+  }
+  entry->hash = hash;
+  entry->slot = slot;
+  memcpy(entry->ua, ua, len);
+  entry->ua[len] = '\0';
+  index[slot] = i + 1;
+
+  if (i == 0) {
+    woothee_topk_sift_down(index, i);
+  } else {
+    woothee_topk_sift_up(index, i);
+  }
+
+  apr_global_mutex_unlock(topk_mutex);
+}
+
+static woothee_order_t *
+woothee_order_get(request_rec *r)
+{
+  const ap_sb_handle_t *sbh = woothee_worker_sbh(r);
+
+  if (!adaptive_orders || !sbh || sbh->thread_num < 0
+      || sbh->thread_num >= adaptive_threads) {
+    return NULL;
   }
 
+  return adaptive_orders[sbh->thread_num];
+}
+
+/*
+ * Request routines
+ */
+
+static apr_status_t
+woothee_request_cleanup(void *data)
+{
+  woothee_request *req = data;
+
+  woothee_delete(req->woothee);
+  req->woothee = NULL;
+
+  return APR_SUCCESS;
+}
+
+static apr_status_t
+woothee_result_cleanup(void *data)
+{
+  woothee_delete(data);
+
+  return APR_SUCCESS;
+}
+
+static woothee_t *
+woothee_request_get(request_rec *r)
+{
+  woothee_request *req;
+  woothee_conf *conf;
+  woothee_stats *stats;
+  const char *ua;
+
+  stats = woothee_stats_get(r);
   conf = ap_get_module_config(r->per_dir_config, &woothee_module);
-  if (conf->notes_enable) {
-    apr_table_set(r->notes, "WOOTHEE_NAME",
-                  apr_pstrdup(r->pool, woothee->name));
-    apr_table_set(r->notes, "WOOTHEE_OS",
-                  apr_pstrdup(r->pool, woothee->os));
-    apr_table_set(r->notes, "WOOTHEE_CATEGORY",
-                  apr_pstrdup(r->pool, woothee->category));
-    apr_table_set(r->notes, "WOOTHEE_OS_VERSION",
-                  apr_pstrdup(r->pool, woothee->os_version));
-    apr_table_set(r->notes, "WOOTHEE_VERSION",
-                  apr_pstrdup(r->pool, woothee->version));
-    apr_table_set(r->notes, "WOOTHEE_VENDOR",
-                  apr_pstrdup(r->pool, woothee->vendor));
+
+  req = ap_get_module_config(r->request_config, &woothee_module);
+  if (req && req->client_hints == (conf->client_hints > 0)) {
+    WOOTHEE_PROBE2(cache__hit, r, r->uri);
+    if (stats) {
+      stats->cache_hits++;
+    }
+    return req->woothee;
   }
 
-  if (conf->header_enable) {
-    for (i = 0; i < fixup->nelts; ++i) {
-      header_entry *hdr = &((header_entry *) (fixup->elts))[i];
-      const char *envar = hdr->condition_var;
+  if (!req) {
+    req = apr_pcalloc(r->pool, sizeof(*req));
+    ap_set_module_config(r->request_config, &woothee_module, req);
+    apr_pool_cleanup_register(r->pool, req, woothee_request_cleanup,
+                              apr_pool_cleanup_null);
+  } else if (req->woothee) {
+    /*
+     * Made in post_read_request with the server's WootheeClientHints,
+     * which a <Location> or .htaccess turned around. Strings of the first
+     * result may still be in use.
+     */
+    apr_pool_cleanup_register(r->pool, req->woothee, woothee_result_cleanup,
+                              apr_pool_cleanup_null);
+    req->woothee = NULL;
+  }
+  req->parse_usec = -1;
+  req->client_hints = (conf->client_hints > 0);
+  req->fields = WOOTHEE_FIELD_ALL;
 
-      /* ignore early headers in late calls */
-      if (!early && (envar == condition_early)) {
-        continue;
+  WOOTHEE_PROBE2(cache__miss, r, r->uri);
+  if (stats) {
+    stats->cache_misses++;
+  }
+
+  if (conf->upstream_prefix) {
+    req->woothee = woothee_upstream(r, conf);
+    if (req->woothee && stats) {
+      stats->upstream++;
+    }
+  }
+  ua = apr_table_get(r->headers_in, "User-Agent");
+  /* crawlers running a headless Chromium send its hints as well */
+  if (!req->woothee && req->client_hints
+      && (ua == NULL || !woothee_maybe_crawler(ua))) {
+    req->woothee = woothee_client_hints(r, r->headers_in);
+    if (req->woothee && stats) {
+      stats->client_hints++;
+    }
+  }
+  if (!req->woothee) {
+    if (ua != NULL) {
+      woothee_server_conf *sconf;
+      apr_time_t start, end;
+
+      sconf = ap_get_module_config(r->server->module_config,
+                                   &woothee_module);
+
+      if (topk) {
+        woothee_topk_add(ua);
       }
-      /* ignore late headers in early calls */
-      else if (early && (envar != condition_early)) {
-        continue;
+
+      req->fields = WOOTHEE_FIELD_BASE | sconf->parse_fields | expr_fields;
+
+      start = apr_time_now();
+      req->woothee = woothee_parse_adaptive(ua, woothee_order_get(r),
+                                            stats ? woothee_stats_rules(stats)
+                                            : NULL, req->fields);
+      end = apr_time_now();
+
+      req->parse_usec = (end > start) ? end - start : 0;
+
+      if (stats) {
+        woothee_stats_parse(stats, req->woothee, start, end);
       }
-      /* Do we have an expression to evaluate? */
-      else if (hdr->expr != NULL) {
-        const char *err = NULL;
-        int eval = ap_expr_exec(r, hdr->expr, &err);
-        if (err) {
-          ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01501)
-                        "Failed to evaluate expression (%s) - ignoring", err);
-        } else if (!eval) {
-          continue;
-        }
+
+#ifdef AP_WOOTHEE_DEBUG_LOG_LEVEL
+      ap_log_rerror(APLOG_MARK, AP_WOOTHEE_DEBUG_LOG_LEVEL, 0, r,
+                    "woothee parse %" APR_TIME_T_FMT " usec: %s",
+                    req->parse_usec, ap_escape_logitem(r->pool, ua));
+#endif
+
+      if (sconf->slow_usec && req->parse_usec >= sconf->slow_usec) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
+                      "slow woothee parse %" APR_TIME_T_FMT " usec: %s",
+                      req->parse_usec, ap_escape_logitem(r->pool, ua));
       }
-      /* Have any conditional envar-controlled Header processing to do? */
-      else if (envar && !early) {
-        if (*envar != '!') {
-          if (apr_table_get(r->subprocess_env, envar) == NULL) {
-            continue;
-          }
-        } else {
+    }
+  }
+
+  return req->woothee;
+}
+
+/*
+ * The per-request result with at least the given fields. Fields that were
+ * not parsed up front (used from .htaccess or a RewriteMap) cost a second,
+ * full parse.
+ */
+static woothee_t *
+woothee_request_fields(request_rec *r, unsigned int fields)
+{
+  woothee_t *woothee = woothee_request_get(r);
+  woothee_request *req;
+  const char *ua;
+
+  req = ap_get_module_config(r->request_config, &woothee_module);
+  if (!woothee || (req->fields & fields) == fields) {
+    return woothee;
+  }
+
+  ua = apr_table_get(r->headers_in, "User-Agent");
+  if (!ua || !(woothee = woothee_parse(ua))) {
+    return woothee_request_get(r);
+  }
+
+  /* strings of the first result may still be in use */
+  apr_pool_cleanup_register(r->pool, req->woothee, woothee_result_cleanup,
+                            apr_pool_cleanup_null);
+  req->woothee = woothee;
+  req->fields = WOOTHEE_FIELD_ALL;
+
+  return woothee;
+}
+
+/*
+ * Rate limit routines
+ */
+
+/* take a token, returning 0 when the bucket is empty */
+static int
+woothee_ratelimit_take(volatile apr_uint32_t *tat,
+                       const woothee_ratelimit *limit)
+{
+  apr_uint32_t now, window, old, base, next;
+
+  now = (apr_uint32_t)apr_time_as_msec(apr_time_now() - ratelimit_epoch);
+  window = limit->interval * limit->burst;
+
+  do {
+    old = apr_atomic_read32(tat);
+
+    /*
+     * A tat in the past (or wrapped around) compares as far ahead of
+     * now, which can never be legitimate, so start from a full bucket.
+     */
+    base = (old - now > window) ? now : old;
+    next = base + limit->interval;
+    if (next - now > window) {
+      return 0;
+    }
+  } while (apr_atomic_cas32(tat, next, old) != old);
+
+  return 1;
+}
+
+/*
+ * Config routines
+ */
+
+static void *
+create_woothee_server_config(apr_pool_t *p, server_rec *s)
+{
+  woothee_server_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+  conf->ratelimits = NULL;
+
+  return conf;
+}
+
+static void *
+merge_woothee_server_config(apr_pool_t *p, void *basev, void *overridesv)
+{
+  woothee_server_conf *newconf = apr_pcalloc(p, sizeof(*newconf));
+  woothee_server_conf *base = basev;
+  woothee_server_conf *overrides = overridesv;
+
+  newconf->ratelimits = overrides->ratelimits ? overrides->ratelimits
+    : base->ratelimits;
+  newconf->status = base->status;
+  newconf->adaptive_order = base->adaptive_order;
+  newconf->disabled_groups = base->disabled_groups;
+  newconf->topk = base->topk;
+  newconf->slow_usec = overrides->slow_usec ? overrides->slow_usec
+    : base->slow_usec;
+  newconf->parse_fields = base->parse_fields | overrides->parse_fields;
+
+  return newconf;
+}
+
+static void *
+create_woothee_dir_config(apr_pool_t *p, char *d)
+{
+  woothee_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+  conf->notes_enable = 0;
+  conf->header_enable = 0;
+  conf->client_hints = -1;
+  conf->accept_client_hints = 0;
+  conf->fixup_in = apr_array_make(p, 2, sizeof(header_entry));
+  conf->header_fields = 0;
+  conf->routes = NULL;
+  conf->route_env = NULL;
+  conf->cache_key = NULL;
+
+  return conf;
+}
+
+static void *
+merge_woothee_config(apr_pool_t *p, void *basev, void *overridesv)
+{
+  woothee_conf *newconf = apr_pcalloc(p, sizeof(*newconf));
+  woothee_conf *base = basev;
+  woothee_conf *overrides = overridesv;
+
+  newconf->notes_enable = overrides->notes_enable;
+  newconf->header_enable = overrides->header_enable;
+  newconf->client_hints = (overrides->client_hints != -1)
+    ? overrides->client_hints : base->client_hints;
+  newconf->accept_client_hints = overrides->accept_client_hints;
+  newconf->fixup_in = apr_array_append(p, base->fixup_in,
+                                       overrides->fixup_in);
+  newconf->header_fields = base->header_fields | overrides->header_fields;
+
+  if (base->exclude && overrides->exclude) {
+    apr_array_header_t *patterns;
+    int i;
+
+    patterns = apr_array_append(p, base->exclude->patterns,
+                                overrides->exclude->patterns);
+    newconf->exclude = woothee_exclude_create(p);
+    for (i = 0; i < patterns->nelts; i++) {
+      woothee_exclude_add(p, newconf->exclude,
+                          ((const char **)patterns->elts)[i]);
+    }
+  } else {
+    newconf->exclude = overrides->exclude ? overrides->exclude : base->exclude;
+  }
+
+  if (base->routes && overrides->routes) {
+    newconf->routes = apr_hash_overlay(p, overrides->routes, base->routes);
+  } else {
+    newconf->routes = overrides->routes ? overrides->routes : base->routes;
+  }
+  newconf->route_env = overrides->route_env ? overrides->route_env
+    : base->route_env;
+  newconf->cache_key = overrides->cache_key ? overrides->cache_key
+    : base->cache_key;
+  if (overrides->upstream_prefix) {
+    newconf->upstream_prefix = overrides->upstream_prefix;
+    newconf->upstream_ips = overrides->upstream_ips;
+  } else {
+    newconf->upstream_prefix = base->upstream_prefix;
+    newconf->upstream_ips = base->upstream_ips;
+  }
+
+  return newconf;
+}
+
+/* WOOTHEE_FIELD_* of a RequestHeaderForWoothee item */
+static unsigned int
+woothee_item_fields(const char *item)
+{
+  if (strcmp(item, "name") == 0) {
+    return WOOTHEE_FIELD_NAME;
+  } else if (strcmp(item, "os") == 0) {
+    return WOOTHEE_FIELD_OS;
+  } else if (strcmp(item, "category") == 0) {
+    return WOOTHEE_FIELD_CATEGORY;
+  } else if (strcmp(item, "os_version") == 0) {
+    return WOOTHEE_FIELD_OS_VERSION;
+  } else if (strcmp(item, "version") == 0) {
+    return WOOTHEE_FIELD_VERSION;
+  } else if (strcmp(item, "vendor") == 0) {
+    return WOOTHEE_FIELD_VENDOR;
+  } else if (strcmp(item, "dict") == 0 || strcmp(item, "dict-id") == 0) {
+    return WOOTHEE_FIELD_ALL;
+  }
+
+  return 0;
+}
+
+/*
+ * Add to the fields the server of the directive parses up front, its
+ * virtual hosts included. Configuration read at request time (.htaccess)
+ * is left to woothee_request_fields().
+ */
+static void
+woothee_fields_use(cmd_parms *cmd, unsigned int fields)
+{
+  woothee_server_conf *sconf;
+
+  if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_RUN_MPM) {
+    sconf = ap_get_module_config(cmd->server->module_config,
+                                 &woothee_module);
+    sconf->parse_fields |= fields;
+  }
+}
+
+/* handle RequestHeader and Header directive */
+static APR_INLINE const char *
+header_inout_cmd(cmd_parms *cmd, void *indirconf,
+                 const char *action, const char *hdr,
+                 const char *value, const char *subs, const char *envclause)
+{
+  woothee_conf *dirconf = indirconf;
+  const char *condition_var = NULL;
+  const char *colon;
+  header_entry *new;
+  ap_expr_info_t *expr = NULL;
+
+  apr_array_header_t *fixup = dirconf->fixup_in;
+
+  new = (header_entry *) apr_array_push(fixup);
+
+  if (!strcasecmp(action, "set")) {
+    new->action = hdr_set;
+  } else if (!strcasecmp(action, "setifempty")) {
+    new->action = hdr_setifempty;
+  } else if (!strcasecmp(action, "add")) {
+    new->action = hdr_add;
+  } else if (!strcasecmp(action, "append")) {
+    new->action = hdr_append;
+  } else if (!strcasecmp(action, "merge")) {
+    new->action = hdr_merge;
+  } else if (!strcasecmp(action, "note")) {
+    new->action = hdr_note;
+  } else {
+    return "first argument must be 'add', 'set', 'setifempty', 'append', "
+      "'merge', 'note'.";
+  }
+
+  /* there's no subs, so envclause is really that argument */
+  if (envclause != NULL) {
+    return "Too many arguments to directive";
+  }
+  envclause = subs;
+
+  if (!value) {
+    return "Header requires three arguments";
+  }
+
+  /* Handle the envclause on Header */
+  if (envclause != NULL) {
+    if (strcasecmp(envclause, "early") == 0) {
+      condition_var = condition_early;
+    } else if (strncasecmp(envclause, "env=", 4) == 0) {
+      if ((envclause[4] == '\0')
+          || ((envclause[4] == '!') && (envclause[5] == '\0'))) {
+        return "error: missing environment variable name. "
+          "envclause should be in the form env=envar ";
+      }
+      condition_var = envclause + 4;
+    } else if (strncasecmp(envclause, "expr=", 5) == 0) {
+      const char *err = NULL;
+      expr = ap_expr_parse_cmd(cmd, envclause + 5, 0, &err, NULL);
+      if (err) {
+        return apr_pstrcat(cmd->pool,
+                           "Can't parse envclause/expression: ", err, NULL);
+      }
+    }
+    else {
+      return apr_pstrcat(cmd->pool, "Unknown parameter: ", envclause, NULL);
+    }
+  }
+
+  if ((colon = ap_strchr_c(hdr, ':'))) {
+    hdr = apr_pstrmemdup(cmd->pool, hdr, colon-hdr);
+  }
+
+  new->header = hdr;
+  new->condition_var = condition_var;
+  new->expr = expr;
+
+  new->item = apr_pstrcat(cmd->pool, value, NULL);
+
+  dirconf->header_fields |= woothee_item_fields(new->item);
+  woothee_fields_use(cmd, dirconf->header_fields);
+
+  return NULL;
+}
+
+/* Handle directives */
+static const char *
+notes_set(cmd_parms *cmd, void *indirconf, int arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  dirconf->notes_enable = arg;
+  if (arg) {
+    woothee_fields_use(cmd, WOOTHEE_FIELD_ALL);
+  }
+
+  return NULL;
+}
+
+static const char *
+header_set(cmd_parms *cmd, void *indirconf, int arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  dirconf->header_enable = arg;
+
+  return NULL;
+}
+
+static const char *
+client_hints_set(cmd_parms *cmd, void *indirconf, int arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  dirconf->client_hints = arg;
+
+  return NULL;
+}
+
+static const char *
+accept_client_hints_set(cmd_parms *cmd, void *indirconf, int arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  dirconf->accept_client_hints = arg;
+
+  return NULL;
+}
+
+static const char *
+exclude_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_conf *dirconf = indirconf;
+  const char *err;
+
+  if (!dirconf->exclude) {
+    dirconf->exclude = woothee_exclude_create(cmd->pool);
+  }
+
+  err = woothee_exclude_add(cmd->pool, dirconf->exclude, arg);
+  if (err) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name, ": ", err, NULL);
+  }
+
+  return NULL;
+}
+
+static const char *
+ratelimit_cmd(cmd_parms *cmd, void *indirconf, const char *target,
+              const char *rate, const char *burst)
+{
+  woothee_server_conf *sconf;
+  woothee_ratelimit limit;
+  const char *err;
+  char *end;
+  double r;
+  apr_int64_t b;
+  int i, index, matched = 0;
+
+  err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  if (err) {
+    return err;
+  }
+
+  r = strtod(rate, &end);
+  if (*end || r <= 0 || r > 1000) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": rate must be a number of requests per second "
+                       "between 0 and 1000", NULL);
+  }
+  b = apr_strtoi64(burst, &end, 10);
+  if (*end || b < 1) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": burst must be a positive integer", NULL);
+  }
+
+  limit.interval = (apr_uint32_t)(1000.0 / r + 0.5);
+  if (limit.interval == 0) {
+    limit.interval = 1;
+  }
+  if ((apr_int64_t)limit.interval * b >= 0x40000000) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": burst / rate is too large", NULL);
+  }
+  limit.burst = (apr_uint32_t)b;
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  if (!sconf->ratelimits) {
+    sconf->ratelimits = apr_pcalloc(cmd->pool,
+                                    sizeof(woothee_ratelimit)
+                                    * woothee_dataset_size());
+  }
+
+  /* a name always takes precedence over its category */
+  index = woothee_dataset_index(target);
+  if (index >= 0) {
+    limit.specific = 1;
+    sconf->ratelimits[index] = limit;
+    return NULL;
+  }
+
+  limit.specific = 0;
+  for (i = 0; i < woothee_dataset_size(); i++) {
+    woothee_data_t *data = woothee_dataset_at(i);
+    if (data->category && strcmp(data->category, target) == 0) {
+      if (!sconf->ratelimits[i].specific) {
+        sconf->ratelimits[i] = limit;
+      }
+      matched = 1;
+    }
+  }
+  if (!matched) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name, ": '", target,
+                       "' is neither a woothee name nor a category", NULL);
+  }
+
+  return NULL;
+}
+
+static const char *
+status_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_server_conf *sconf;
+  const char *err;
+
+  err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  if (err) {
+    return err;
+  }
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  if (strcasecmp(arg, "On") == 0) {
+    sconf->status = WOOTHEE_STATUS_ON;
+  } else if (strcasecmp(arg, "Off") == 0) {
+    sconf->status = WOOTHEE_STATUS_OFF;
+  } else if (strcasecmp(arg, "Rules") == 0) {
+    sconf->status = WOOTHEE_STATUS_RULES;
+  } else {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       " must be On, Off or Rules", NULL);
+  }
+
+  return NULL;
+}
+
+static const char *
+adaptive_order_cmd(cmd_parms *cmd, void *indirconf, int arg)
+{
+  woothee_server_conf *sconf;
+  const char *err;
+
+  err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  if (err) {
+    return err;
+  }
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  sconf->adaptive_order = arg;
+
+  return NULL;
+}
+
+static const char *
+disable_groups_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_server_conf *sconf;
+  const char *err;
+  int group;
+
+  err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  if (err) {
+    return err;
+  }
+
+  group = woothee_group_index(arg);
+  if (group < 0) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": unknown challenge group '", arg, "'", NULL);
+  }
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  sconf->disabled_groups |= 1U << group;
+
+  return NULL;
+}
+
+static const char *
+trust_upstream_cmd(cmd_parms *cmd, void *indirconf, int argc,
+                   char *const argv[])
+{
+  woothee_conf *dirconf = indirconf;
+  int i;
+
+  if (argc < 2) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       " requires a header prefix and at least one "
+                       "address or CIDR", NULL);
+  }
+
+  dirconf->upstream_prefix = argv[0];
+  dirconf->upstream_ips = apr_array_make(cmd->pool, argc - 1,
+                                         sizeof(apr_ipsubnet_t *));
+
+  for (i = 1; i < argc; i++) {
+    apr_ipsubnet_t **ip = apr_array_push(dirconf->upstream_ips);
+    char *addr = apr_pstrdup(cmd->temp_pool, argv[i]);
+    char *mask = ap_strchr(addr, '/');
+    apr_status_t rv;
+
+    if (mask) {
+      *mask++ = '\0';
+    }
+
+    rv = apr_ipsubnet_create(ip, addr, mask, cmd->pool);
+    if (rv != APR_SUCCESS) {
+      char buf[120];
+      apr_strerror(rv, buf, sizeof(buf));
+      return apr_psprintf(cmd->pool, "%s: invalid address '%s': %s",
+                          cmd->cmd->name, argv[i], buf);
+    }
+  }
+
+  return NULL;
+}
+
+static const char *
+topk_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_server_conf *sconf;
+  const char *err;
+  char *end;
+  apr_int64_t k;
+
+  err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+  if (err) {
+    return err;
+  }
+
+  k = apr_strtoi64(arg, &end, 10);
+  if (*end || k < 1 || k > 65536) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": the number of User-Agents must be between "
+                       "1 and 65536", NULL);
+  }
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  sconf->topk = (int)k;
+
+  return NULL;
+}
+
+static const char *
+slow_log_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_server_conf *sconf;
+  apr_int64_t usec;
+  char *end;
+
+  usec = apr_strtoi64(arg, &end, 10);
+  if (*end || usec < 1) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": threshold must be a positive number of "
+                       "microseconds", NULL);
+  }
+
+  sconf = ap_get_module_config(cmd->server->module_config, &woothee_module);
+  sconf->slow_usec = (apr_interval_time_t)usec;
+
+  return NULL;
+}
+
+static const char *
+route_cmd(cmd_parms *cmd, void *indirconf, const char *key,
+          const char *route)
+{
+  woothee_conf *dirconf = indirconf;
+
+  if (!dirconf->routes) {
+    dirconf->routes = apr_hash_make(cmd->pool);
+  }
+
+  apr_hash_set(dirconf->routes, key, APR_HASH_KEY_STRING, route);
+
+  return NULL;
+}
+
+static const char *
+route_env_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  dirconf->route_env = arg;
+
+  return NULL;
+}
+
+static const char *
+cache_key_cmd(cmd_parms *cmd, void *indirconf, const char *arg)
+{
+  woothee_conf *dirconf = indirconf;
+
+  if (strcasecmp(arg, "User-Agent") == 0) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       ": header must not be User-Agent", NULL);
+  }
+
+  dirconf->cache_key = arg;
+  woothee_fields_use(cmd, WOOTHEE_FIELD_VERSION);
+
+  return NULL;
+}
+
+static const char *
+header_cmd(cmd_parms *cmd, void *indirconf, const char *args)
+{
+  const char *action;
+  const char *hdr;
+  const char *val;
+  const char *envclause;
+  const char *subs;
+
+  action = ap_getword_conf(cmd->temp_pool, &args);
+  hdr = ap_getword_conf(cmd->pool, &args);
+  val = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
+  subs = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
+  envclause = *args ? ap_getword_conf(cmd->pool, &args) : NULL;
+
+  if (*args) {
+    return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                       " has too many arguments", NULL);
+  }
+
+  return header_inout_cmd(cmd, indirconf, action, hdr, val, subs, envclause);
+}
+
+/* an RFC 8941 sf-string, with characters it can not carry replaced by ? */
+static void
+sf_append_string(apr_array_header_t *buf, const char *value)
+{
+  *(char *)apr_array_push(buf) = '"';
+  for (; *value; value++) {
+    unsigned char c = (unsigned char)*value;
+    if (c == '"' || c == '\\') {
+      *(char *)apr_array_push(buf) = '\\';
+    } else if (c < 0x20 || c > 0x7e) {
+      c = '?';
+    }
+    *(char *)apr_array_push(buf) = (char)c;
+  }
+  *(char *)apr_array_push(buf) = '"';
+}
+
+static void
+sf_append_member(apr_array_header_t *buf, const char *key, const char *value)
+{
+  if (buf->nelts) {
+    *(char *)apr_array_push(buf) = ',';
+    *(char *)apr_array_push(buf) = ' ';
+  }
+  while (*key) {
+    *(char *)apr_array_push(buf) = *key++;
+  }
+  *(char *)apr_array_push(buf) = '=';
+  sf_append_string(buf, value);
+}
+
+/*
+ * The whole result as an RFC 8941 dictionary:
+ *   name="Chrome", category="pc", os="Windows 10", ...
+ */
+static char *
+woothee_dict(request_rec *r, woothee_t *woothee)
+{
+  apr_array_header_t *buf = apr_array_make(r->pool, 128, sizeof(char));
+
+  sf_append_member(buf, "name", woothee->name);
+  sf_append_member(buf, "category", woothee->category);
+  sf_append_member(buf, "os", woothee->os);
+  sf_append_member(buf, "os_version", woothee->os_version);
+  sf_append_member(buf, "version", woothee->version);
+  sf_append_member(buf, "vendor", woothee->vendor);
+
+  *(char *)apr_array_push(buf) = '\0';
+
+  return buf->elts;
+}
+
+/*
+ * The compact dictionary: name and os as woothee dataset indexes (-1 for
+ * values outside the dataset), the woothee_category_id() of the category and
+ * the versions as strings.
+ * The vendor follows from the name.
+ *   n=2, c=0, o=9, v="120.0.6099.71", ov="NT 10.0"
+ */
+static char *
+woothee_dict_id(request_rec *r, woothee_t *woothee)
+{
+  apr_array_header_t *buf = apr_array_make(r->pool, 64, sizeof(char));
+  const char *ids;
+
+  ids = apr_psprintf(r->pool, "n=%d, c=%d, o=%d",
+                     woothee_name_index(woothee->name),
+                     woothee_category_id(woothee->category),
+                     woothee_name_index(woothee->os));
+  while (*ids) {
+    *(char *)apr_array_push(buf) = *ids++;
+  }
+  sf_append_member(buf, "v", woothee->version);
+  sf_append_member(buf, "ov", woothee->os_version);
+
+  *(char *)apr_array_push(buf) = '\0';
+
+  return buf->elts;
+}
+
+/*
+ * Process the item in the woothee struct.
+ */
+static char *
+woothee_process_item(header_entry *hdr, request_rec *r, woothee_t *woothee)
+{
+  const char *v = NULL;
+  const char *item = NULL;
+  char *str = NULL;
+
+  if (!woothee) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02557)
+                  "Can't evaluate value woothee");
+    return "";
+  }
+
+  item = (const char *)hdr->item;
+
+  if (item) {
+    if (strcmp(item, "dict") == 0) {
+      return woothee_dict(r, woothee);
+    } else if (strcmp(item, "dict-id") == 0) {
+      return woothee_dict_id(r, woothee);
+    } else if (strcmp(item, "name") == 0) {
+      v = woothee->name;
+    } else if (strcmp(item, "os") == 0) {
+      v = woothee->os;
+    } else if (strcmp(item, "category") == 0) {
+      v = woothee->category;
+    } else if (strcmp(item, "os_version") == 0) {
+      v = woothee->os_version;
+    } else if (strcmp(item, "version") == 0) {
+      v = woothee->version;
+    } else if (strcmp(item, "vendor") == 0) {
+      v = woothee->vendor;
+    }
+  }
+
+  if (v) {
+    str = apr_pstrdup(r->pool, v);
+  }
+
+  return str ? str : "";
+}
+
+static int
+do_woothee_fixup(request_rec *r, apr_table_t *headers,
+                 apr_array_header_t *fixup, int early)
+{
+  int i;
+  const char *val;
+  woothee_conf *conf;
+  woothee_request *req;
+  woothee_t *woothee;
+
+  conf = ap_get_module_config(r->per_dir_config, &woothee_module);
+
+  woothee = woothee_request_fields(r, conf->notes_enable ? WOOTHEE_FIELD_ALL
+                                   : conf->header_fields);
+  if (!woothee) {
+    return 1;
+  }
+
+  if (conf->notes_enable) {
+    apr_table_set(r->notes, "WOOTHEE_NAME",
+                  apr_pstrdup(r->pool, woothee->name));
+    apr_table_set(r->notes, "WOOTHEE_OS",
+                  apr_pstrdup(r->pool, woothee->os));
+    apr_table_set(r->notes, "WOOTHEE_CATEGORY",
+                  apr_pstrdup(r->pool, woothee->category));
+    apr_table_set(r->notes, "WOOTHEE_OS_VERSION",
+                  apr_pstrdup(r->pool, woothee->os_version));
+    apr_table_set(r->notes, "WOOTHEE_VERSION",
+                  apr_pstrdup(r->pool, woothee->version));
+    apr_table_set(r->notes, "WOOTHEE_VENDOR",
+                  apr_pstrdup(r->pool, woothee->vendor));
+
+    req = ap_get_module_config(r->request_config, &woothee_module);
+    if (req->parse_usec >= 0) {
+      apr_table_set(r->notes, "WOOTHEE_PARSE_USEC",
+                    apr_psprintf(r->pool, "%" APR_TIME_T_FMT,
+                                 req->parse_usec));
+    }
+  }
+
+  if (conf->header_enable) {
+    for (i = 0; i < fixup->nelts; ++i) {
+      header_entry *hdr = &((header_entry *) (fixup->elts))[i];
+      const char *envar = hdr->condition_var;
+
+      /* ignore early headers in late calls */
+      if (!early && (envar == condition_early)) {
+        continue;
+      }
+      /* ignore late headers in early calls */
+      else if (early && (envar != condition_early)) {
+        continue;
+      }
+      /* Do we have an expression to evaluate? */
+      else if (hdr->expr != NULL) {
+        const char *err = NULL;
+        int eval = ap_expr_exec(r, hdr->expr, &err);
+        if (err) {
+          ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01501)
+                        "Failed to evaluate expression (%s) - ignoring", err);
+        } else if (!eval) {
+          continue;
+        }
+      }
+      /* Have any conditional envar-controlled Header processing to do? */
+      else if (envar && !early) {
+        if (*envar != '!') {
+          if (apr_table_get(r->subprocess_env, envar) == NULL) {
+            continue;
+          }
+        } else {
           if (apr_table_get(r->subprocess_env, &envar[1]) != NULL) {
             continue;
           }
         }
       }
 
-      switch (hdr->action) {
-        case hdr_add:
-          apr_table_addn(headers, hdr->header,
-                         woothee_process_item(hdr, r, woothee));
-          break;
-        case hdr_append:
-          apr_table_mergen(headers, hdr->header,
-                           woothee_process_item(hdr, r, woothee));
-          break;
-        case hdr_merge:
-          val = apr_table_get(headers, hdr->header);
-          if (val == NULL) {
-            apr_table_addn(headers, hdr->header,
-                           woothee_process_item(hdr, r, woothee));
-          } else {
-            char *new_val = woothee_process_item(hdr, r, woothee);
-            apr_size_t new_val_len = strlen(new_val);
-            int tok_found = 0;
+      switch (hdr->action) {
+        case hdr_add:
+          apr_table_addn(headers, hdr->header,
+                         woothee_process_item(hdr, r, woothee));
+          break;
+        case hdr_append:
+          apr_table_mergen(headers, hdr->header,
+                           woothee_process_item(hdr, r, woothee));
+          break;
+        case hdr_merge:
+          val = apr_table_get(headers, hdr->header);
+          if (val == NULL) {
+            apr_table_addn(headers, hdr->header,
+                           woothee_process_item(hdr, r, woothee));
+          } else {
+            char *new_val = woothee_process_item(hdr, r, woothee);
+            apr_size_t new_val_len = strlen(new_val);
+            int tok_found = 0;
+
+            /* modified version of logic in ap_get_token() */
+            while (*val) {
+              const char *tok_start;
+
+              while (apr_isspace(*val)) {
+                ++val;
+              }
+              tok_start = val;
+
+              while (*val && *val != ',') {
+                if (*val++ == '"') {
+                  while (*val) {
+                    if (*val++ == '"') {
+                      break;
+                    }
+                  }
+                }
+              }
+
+              if (new_val_len == (apr_size_t)(val - tok_start)
+                  && !strncmp(tok_start, new_val, new_val_len)) {
+                tok_found = 1;
+                break;
+              }
+
+              if (*val) {
+                ++val;
+              }
+            }
+
+            if (!tok_found) {
+              apr_table_mergen(headers, hdr->header, new_val);
+            }
+          }
+          break;
+        case hdr_set:
+          apr_table_setn(headers, hdr->header,
+                         woothee_process_item(hdr, r, woothee));
+          break;
+        case hdr_setifempty:
+          if (NULL == apr_table_get(headers, hdr->header)) {
+            apr_table_setn(headers, hdr->header,
+                           woothee_process_item(hdr, r, woothee));
+          }
+          break;
+        case hdr_note:
+          apr_table_setn(r->notes, woothee_process_item(hdr, r, woothee),
+                         apr_table_get(headers, hdr->header));
+          break;
+      }
+    }
+  }
+
+  return 1;
+}
+
+static apr_status_t
+ap_woothee_fixup(request_rec *r)
+{
+  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
+                                               &woothee_module);
+
+  if (woothee_request_excluded(r, dirconf->exclude)) {
+    return DECLINED;
+  }
+
+  if (dirconf->accept_client_hints && !r->main) {
+    apr_table_mergen(r->err_headers_out, "Accept-CH", accept_client_hints);
+  }
+
+  /* do the fixup */
+  if (dirconf->fixup_in->nelts) {
+    do_woothee_fixup(r, r->headers_in, dirconf->fixup_in, 0);
+  }
+
+  return DECLINED;
+}
+
+/*
+ * Set the route of the first WootheeRoute matching the woothee name, then
+ * the category, then "*".
+ */
+static void
+woothee_route(request_rec *r, woothee_conf *conf)
+{
+  woothee_t *woothee = woothee_request_get(r);
+  const char *route = NULL;
+
+  if (woothee) {
+    route = apr_hash_get(conf->routes, woothee->name, APR_HASH_KEY_STRING);
+    if (!route) {
+      route = apr_hash_get(conf->routes, woothee->category,
+                           APR_HASH_KEY_STRING);
+    }
+  }
+  if (!route) {
+    route = apr_hash_get(conf->routes, "*", APR_HASH_KEY_STRING);
+  }
+
+  if (route) {
+    apr_table_setn(r->subprocess_env,
+                   conf->route_env ? conf->route_env : route_env_default,
+                   route);
+  }
+}
+
+/*
+ * Low cardinality "category|os|major-version" key, for caches to vary on
+ * in place of the User-Agent.
+ */
+static void
+woothee_cache_key(request_rec *r, woothee_conf *conf)
+{
+  woothee_t *woothee = woothee_request_fields(r, WOOTHEE_FIELD_VERSION);
+  const char *version;
+  apr_size_t len;
+
+  if (!woothee) {
+    apr_table_setn(r->headers_in, conf->cache_key, "-");
+    return;
+  }
+
+  version = woothee->version;
+  len = 0;
+  while (apr_isdigit(version[len])) {
+    len++;
+  }
+  if (len == 0) {
+    len = strlen(version);
+  }
+
+  apr_table_setn(r->headers_in, conf->cache_key,
+                 apr_pstrcat(r->pool, woothee->category, "|", woothee->os,
+                             "|", apr_pstrmemdup(r->pool, version, len),
+                             NULL));
+}
+
+typedef struct {
+  apr_pool_t *pool;
+  const char *cache_key;
+  apr_array_header_t *tokens;
+  int rewritten;
+} woothee_vary_ctx;
+
+static int
+woothee_vary_tokens(void *rec, const char *key, const char *value)
+{
+  woothee_vary_ctx *ctx = rec;
+  const char *s = value;
+
+  while (*s) {
+    const char *start, *end, *token;
+    int i;
+
+    while (*s == ',' || apr_isspace(*s)) {
+      s++;
+    }
+    start = s;
+    while (*s && *s != ',') {
+      s++;
+    }
+    end = s;
+    while (end > start && apr_isspace(end[-1])) {
+      end--;
+    }
+    if (end == start) {
+      continue;
+    }
+
+    token = apr_pstrmemdup(ctx->pool, start, end - start);
+    if (strcasecmp(token, "User-Agent") == 0) {
+      token = ctx->cache_key;
+      ctx->rewritten = 1;
+    }
+
+    for (i = 0; i < ctx->tokens->nelts; i++) {
+      if (strcasecmp(token, ((const char **)ctx->tokens->elts)[i]) == 0) {
+        break;
+      }
+    }
+    if (i == ctx->tokens->nelts) {
+      *(const char **)apr_array_push(ctx->tokens) = token;
+    }
+  }
+
+  return 1;
+}
+
+static void
+woothee_vary_rewrite(request_rec *r, apr_table_t *headers,
+                     const char *cache_key)
+{
+  woothee_vary_ctx ctx;
+
+  ctx.pool = r->pool;
+  ctx.cache_key = cache_key;
+  ctx.tokens = apr_array_make(r->pool, 4, sizeof(const char *));
+  ctx.rewritten = 0;
+
+  apr_table_do(woothee_vary_tokens, &ctx, headers, "Vary", NULL);
+
+  if (ctx.rewritten) {
+    apr_table_setn(headers, "Vary",
+                   apr_array_pstrcat(r->pool, ctx.tokens, ','));
+  }
+}
+
+/* rewrite Vary: User-Agent to the WootheeCacheKey header */
+static apr_status_t
+woothee_vary_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+  request_rec *r = f->r;
+  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
+                                               &woothee_module);
+
+  if (dirconf->cache_key) {
+    woothee_vary_rewrite(r, r->headers_out, dirconf->cache_key);
+    woothee_vary_rewrite(r, r->err_headers_out, dirconf->cache_key);
+  }
+
+  ap_remove_output_filter(f);
+
+  return ap_pass_brigade(f->next, bb);
+}
+
+typedef struct {
+  apr_pool_t *pool;
+  const char *cache_key;
+  int has_key;
+  int has_user_agent;
+} woothee_vary_restore_ctx;
+
+static int
+woothee_vary_find(void *rec, const char *key, const char *value)
+{
+  woothee_vary_restore_ctx *ctx = rec;
+
+  if (ap_find_token(ctx->pool, value, ctx->cache_key)) {
+    ctx->has_key = 1;
+  }
+  if (ap_find_token(ctx->pool, value, "User-Agent")) {
+    ctx->has_user_agent = 1;
+  }
+
+  return 1;
+}
+
+static void
+woothee_vary_restore(request_rec *r, apr_table_t *headers,
+                     const char *cache_key)
+{
+  woothee_vary_restore_ctx ctx;
+
+  ctx.pool = r->pool;
+  ctx.cache_key = cache_key;
+  ctx.has_key = 0;
+  ctx.has_user_agent = 0;
+
+  apr_table_do(woothee_vary_find, &ctx, headers, "Vary", NULL);
+
+  if (ctx.has_key && !ctx.has_user_agent) {
+    apr_table_mergen(headers, "Vary", "User-Agent");
+  }
+}
+
+/*
+ * Put User-Agent back in the Vary sent to the client, once CACHE_SAVE has
+ * stored the rewritten one: browsers and downstream caches never send the
+ * key header, so varying on it alone would share one device's variant.
+ * Cached responses get it back as well, this filter runs after CACHE_OUT.
+ */
+static apr_status_t
+woothee_vary_restore_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+  request_rec *r = f->r;
+  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
+                                               &woothee_module);
+
+  if (dirconf->cache_key) {
+    woothee_vary_restore(r, r->headers_out, dirconf->cache_key);
+    woothee_vary_restore(r, r->err_headers_out, dirconf->cache_key);
+  }
+
+  ap_remove_output_filter(f);
+
+  return ap_pass_brigade(f->next, bb);
+}
+
+static void
+woothee_insert_filter(request_rec *r)
+{
+  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
+                                               &woothee_module);
+
+  /* the key header is only there when ap_woothee_early() has set it */
+  if (dirconf->cache_key
+      && apr_table_get(r->headers_in, dirconf->cache_key)) {
+    ap_add_output_filter("WOOTHEE_VARY", NULL, r, r->connection);
+    ap_add_output_filter("WOOTHEE_VARY_RESTORE", NULL, r, r->connection);
+  }
+}
+
+static apr_status_t
+ap_woothee_early(request_rec *r)
+{
+  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
+                                               &woothee_module);
+  woothee_stats *stats = woothee_stats_get(r);
+
+  if (stats) {
+    stats->requests++;
+  }
+
+  if (woothee_request_excluded(r, dirconf->exclude)) {
+    if (stats) {
+      stats->excluded++;
+    }
+    /* no key of the client's, Vary: User-Agent is then left as is */
+    if (dirconf->cache_key) {
+      apr_table_unset(r->headers_in, dirconf->cache_key);
+    }
+    return DECLINED;
+  }
+
+  if (dirconf->routes) {
+    woothee_route(r, dirconf);
+  }
+
+  if (dirconf->cache_key) {
+    woothee_cache_key(r, dirconf);
+  }
+
+  /* do the fixup */
+  if (dirconf->fixup_in->nelts) {
+    if (!do_woothee_fixup(r, r->headers_in, dirconf->fixup_in, 1)) {
+      ap_log_rerror(APLOG_MARK, APLOG_CRIT, 0, r, APLOGNO(01504)
+                    "Regular expression replacement failed "
+                    "(replacement too long?)");
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+
+  return DECLINED;
+}
+
+/*
+ * Authorization providers
+ */
+
+static const char *
+woothee_parse_require_line(cmd_parms *cmd, const char *name,
+                           const char *require_line,
+                           const void **parsed_require_line)
+{
+  apr_array_header_t *words = apr_array_make(cmd->pool, 2, sizeof(char *));
+  const char *t = require_line;
+  const char *w;
+
+  while ((w = ap_getword_conf(cmd->pool, &t)) && w[0]) {
+    *(const char **)apr_array_push(words) = w;
+  }
+
+  if (words->nelts == 0) {
+    return apr_pstrcat(cmd->pool, "Require ", name,
+                       " needs at least one value", NULL);
+  }
+
+  *parsed_require_line = words;
+
+  return NULL;
+}
+
+static const char *
+woothee_category_parse_require_line(cmd_parms *cmd, const char *require_line,
+                                    const void **parsed_require_line)
+{
+  const apr_array_header_t *words;
+  const char *err;
+  int i, j;
+
+  err = woothee_parse_require_line(cmd, "woothee-category", require_line,
+                                   parsed_require_line);
+  if (err) {
+    return err;
+  }
+
+  words = *parsed_require_line;
+  for (i = 0; i < words->nelts; i++) {
+    const char *w = ((const char **)words->elts)[i];
+
+    for (j = 0; j < WOOTHEE_CATEGORY_SIZE; j++) {
+      if (strcasecmp(w, woothee_category_name(j)) == 0) {
+        break;
+      }
+    }
+    if (j == WOOTHEE_CATEGORY_SIZE) {
+      return apr_pstrcat(cmd->pool, "Require woothee-category: "
+                         "unknown category '", w, "'", NULL);
+    }
+  }
+
+  return NULL;
+}
+
+static const char *
+woothee_name_parse_require_line(cmd_parms *cmd, const char *require_line,
+                                const void **parsed_require_line)
+{
+  return woothee_parse_require_line(cmd, "woothee-name", require_line,
+                                    parsed_require_line);
+}
+
+static const char *
+woothee_crawler_parse_require_line(cmd_parms *cmd, const char *require_line,
+                                   const void **parsed_require_line)
+{
+  const char *t = require_line;
+
+  if (*ap_getword_conf(cmd->temp_pool, &t)) {
+    return "Require woothee-crawler does not take arguments";
+  }
+
+  return NULL;
+}
+
+static authz_status
+woothee_match_require_line(const char *value,
+                           const void *parsed_require_line)
+{
+  const apr_array_header_t *words = parsed_require_line;
+  int i;
+
+  for (i = 0; i < words->nelts; i++) {
+    if (strcasecmp(value, ((const char **)words->elts)[i]) == 0) {
+      return AUTHZ_GRANTED;
+    }
+  }
+
+  return AUTHZ_DENIED;
+}
+
+static authz_status
+woothee_category_check_authorization(request_rec *r,
+                                     const char *require_line,
+                                     const void *parsed_require_line)
+{
+  woothee_t *woothee = woothee_request_get(r);
+
+  if (!woothee) {
+    return AUTHZ_DENIED;
+  }
+
+  return woothee_match_require_line(woothee->category, parsed_require_line);
+}
+
+static authz_status
+woothee_name_check_authorization(request_rec *r,
+                                 const char *require_line,
+                                 const void *parsed_require_line)
+{
+  woothee_t *woothee = woothee_request_get(r);
+
+  if (!woothee) {
+    return AUTHZ_DENIED;
+  }
+
+  return woothee_match_require_line(woothee->name, parsed_require_line);
+}
+
+/*
+ * crawler check only, without a full parse of the User-Agent. The
+ * per-request result is not used, so whether another directive parsed
+ * the request first does not change the answer.
+ */
+static authz_status
+woothee_crawler_check_authorization(request_rec *r,
+                                    const char *require_line,
+                                    const void *parsed_require_line)
+{
+  const char *ua;
+
+  ua = apr_table_get(r->headers_in, "User-Agent");
+  if (ua == NULL || !woothee_maybe_crawler(ua)) {
+    return AUTHZ_DENIED;
+  }
+
+  return AUTHZ_GRANTED;
+}
+
+static const authz_provider authz_woothee_category_provider =
+{
+  &woothee_category_check_authorization,
+  &woothee_category_parse_require_line,
+};
+
+static const authz_provider authz_woothee_name_provider =
+{
+  &woothee_name_check_authorization,
+  &woothee_name_parse_require_line,
+};
+
+static const authz_provider authz_woothee_crawler_provider =
+{
+  &woothee_crawler_check_authorization,
+  &woothee_crawler_parse_require_line,
+};
+
+static apr_status_t
+ap_woothee_ratelimit(request_rec *r)
+{
+  woothee_server_conf *sconf;
+  woothee_conf *dirconf;
+  woothee_ratelimit *limit;
+  woothee_t *woothee;
+  int index;
+
+  sconf = ap_get_module_config(r->server->module_config, &woothee_module);
+  if (!sconf->ratelimits || !ratelimit_tat || r->prev) {
+    return DECLINED;
+  }
+
+  dirconf = ap_get_module_config(r->per_dir_config, &woothee_module);
+  if (woothee_request_excluded(r, dirconf->exclude)) {
+    return DECLINED;
+  }
+
+  woothee = woothee_request_get(r);
+  if (!woothee) {
+    return DECLINED;
+  }
+
+  index = woothee_name_index(woothee->name);
+  if (index < 0) {
+    return DECLINED;
+  }
+
+  limit = &sconf->ratelimits[index];
+  if (limit->interval == 0) {
+    return DECLINED;
+  }
+
+  if (!woothee_ratelimit_take(&ratelimit_tat[index], limit)) {
+    ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r,
+                  "woothee rate limit exceeded for %s", woothee->name);
+    return HTTP_TOO_MANY_REQUESTS;
+  }
+
+  return DECLINED;
+}
+
+/*
+ * Status handler
+ */
+
+/*
+ * Sum the counters of every slot. Slots are read without locking while
+ * workers update them, so a total may lag by the requests in flight.
+ */
+static woothee_stats *
+woothee_stats_sum(apr_pool_t *p)
+{
+  woothee_stats *sum = apr_pcalloc(p, status_slot_size);
+  apr_uint64_t *total = (apr_uint64_t *)sum;
+  apr_size_t n = status_slot_size / sizeof(apr_uint64_t);
+  apr_size_t i;
+  int slot;
+
+  for (slot = 0; slot < status_nslots; slot++) {
+    const apr_uint64_t *counter
+      = (const apr_uint64_t *)(status_slots + slot * status_slot_size);
+    for (i = 0; i < n; i++) {
+      total[i] += counter[i];
+    }
+  }
+
+  return sum;
+}
+
+static const char *
+woothee_stats_name(int index)
+{
+  if (index < woothee_dataset_size()) {
+    return woothee_dataset_at(index)->name;
+  }
+  return WOOTHEE_DATASET_VALUE_UNKNOWN;
+}
+
+static void
+woothee_status_text(request_rec *r, const woothee_stats *stats)
+{
+  int i;
+
+  ap_rprintf(r, "Requests: %" APR_UINT64_T_FMT "\n", stats->requests);
+  ap_rprintf(r, "Excluded: %" APR_UINT64_T_FMT "\n", stats->excluded);
+  ap_rprintf(r, "Parses: %" APR_UINT64_T_FMT "\n", stats->parses);
+  ap_rprintf(r, "ParseMicroseconds: %" APR_UINT64_T_FMT "\n",
+             stats->parse_usec);
+  ap_rprintf(r, "ClientHints: %" APR_UINT64_T_FMT "\n",
+             stats->client_hints);
+  ap_rprintf(r, "Upstream: %" APR_UINT64_T_FMT "\n", stats->upstream);
+  ap_rprintf(r, "CacheHits: %" APR_UINT64_T_FMT "\n", stats->cache_hits);
+  ap_rprintf(r, "CacheMisses: %" APR_UINT64_T_FMT "\n",
+             stats->cache_misses);
+
+  for (i = 0; i < WOOTHEE_LATENCY_BUCKETS - 1; i++) {
+    ap_rprintf(r, "Latency[<=%" APR_UINT64_T_FMT "us]: %" APR_UINT64_T_FMT
+               "\n", (apr_uint64_t)1 << i, stats->latency[i]);
+  }
+  ap_rprintf(r, "Latency[>%" APR_UINT64_T_FMT "us]: %" APR_UINT64_T_FMT "\n",
+             (apr_uint64_t)1 << (WOOTHEE_LATENCY_BUCKETS - 2),
+             stats->latency[WOOTHEE_LATENCY_BUCKETS - 1]);
+
+  for (i = 0; i < WOOTHEE_CATEGORY_SIZE; i++) {
+    ap_rprintf(r, "Category[%s]: %" APR_UINT64_T_FMT "\n",
+               woothee_category_name(i), stats->categories[i]);
+  }
+
+  for (i = 0; i <= woothee_dataset_size(); i++) {
+    if (woothee_stats_names(stats)[i]) {
+      ap_rprintf(r, "Name[%s]: %" APR_UINT64_T_FMT "\n",
+                 woothee_stats_name(i), woothee_stats_names(stats)[i]);
+    }
+  }
+
+  for (i = 0; i < woothee_rule_size(); i++) {
+    const woothee_rule_stat_t *rule = &woothee_stats_rules(stats)[i];
+    if (status_rule_timing) {
+      ap_rprintf(r, "Rule[%s]: calls %llu, hits %llu, nsec %llu, "
+                 "depth %llu\n", woothee_rule_name(i), rule->calls,
+                 rule->hits, rule->nsec, rule->depth);
+    } else {
+      ap_rprintf(r, "Rule[%s]: calls %llu, hits %llu, depth %llu\n",
+                 woothee_rule_name(i), rule->calls, rule->hits, rule->depth);
+    }
+  }
+}
+
+static void
+woothee_status_prometheus(request_rec *r, const woothee_stats *stats)
+{
+  apr_uint64_t count = 0;
+  int i;
+
+  ap_rputs("# TYPE woothee_requests_total counter\n", r);
+  ap_rprintf(r, "woothee_requests_total %" APR_UINT64_T_FMT "\n",
+             stats->requests);
+  ap_rputs("# TYPE woothee_excluded_total counter\n", r);
+  ap_rprintf(r, "woothee_excluded_total %" APR_UINT64_T_FMT "\n",
+             stats->excluded);
+  ap_rputs("# TYPE woothee_client_hints_total counter\n", r);
+  ap_rprintf(r, "woothee_client_hints_total %" APR_UINT64_T_FMT "\n",
+             stats->client_hints);
+  ap_rputs("# TYPE woothee_upstream_total counter\n", r);
+  ap_rprintf(r, "woothee_upstream_total %" APR_UINT64_T_FMT "\n",
+             stats->upstream);
+  ap_rputs("# TYPE woothee_cache_hits_total counter\n", r);
+  ap_rprintf(r, "woothee_cache_hits_total %" APR_UINT64_T_FMT "\n",
+             stats->cache_hits);
+  ap_rputs("# TYPE woothee_cache_misses_total counter\n", r);
+  ap_rprintf(r, "woothee_cache_misses_total %" APR_UINT64_T_FMT "\n",
+             stats->cache_misses);
+
+  ap_rputs("# TYPE woothee_parse_duration_microseconds histogram\n", r);
+  for (i = 0; i < WOOTHEE_LATENCY_BUCKETS - 1; i++) {
+    count += stats->latency[i];
+    ap_rprintf(r, "woothee_parse_duration_microseconds_bucket"
+               "{le=\"%" APR_UINT64_T_FMT "\"} %" APR_UINT64_T_FMT "\n",
+               (apr_uint64_t)1 << i, count);
+  }
+  ap_rprintf(r, "woothee_parse_duration_microseconds_bucket"
+             "{le=\"+Inf\"} %" APR_UINT64_T_FMT "\n", stats->parses);
+  ap_rprintf(r, "woothee_parse_duration_microseconds_sum %" APR_UINT64_T_FMT
+             "\n", stats->parse_usec);
+  ap_rprintf(r, "woothee_parse_duration_microseconds_count %"
+             APR_UINT64_T_FMT "\n", stats->parses);
+
+  ap_rputs("# TYPE woothee_category_total counter\n", r);
+  for (i = 0; i < WOOTHEE_CATEGORY_SIZE; i++) {
+    ap_rprintf(r, "woothee_category_total{category=\"%s\"} %"
+               APR_UINT64_T_FMT "\n",
+               woothee_category_name(i), stats->categories[i]);
+  }
+
+  ap_rputs("# TYPE woothee_name_total counter\n", r);
+  for (i = 0; i <= woothee_dataset_size(); i++) {
+    if (woothee_stats_names(stats)[i]) {
+      ap_rprintf(r, "woothee_name_total{name=\"%s\"} %" APR_UINT64_T_FMT
+                 "\n", woothee_stats_name(i), woothee_stats_names(stats)[i]);
+    }
+  }
+
+  ap_rputs("# TYPE woothee_rule_calls_total counter\n", r);
+  for (i = 0; i < woothee_rule_size(); i++) {
+    ap_rprintf(r, "woothee_rule_calls_total{rule=\"%s\"} %llu\n",
+               woothee_rule_name(i), woothee_stats_rules(stats)[i].calls);
+  }
+  ap_rputs("# TYPE woothee_rule_hits_total counter\n", r);
+  for (i = 0; i < woothee_rule_size(); i++) {
+    ap_rprintf(r, "woothee_rule_hits_total{rule=\"%s\"} %llu\n",
+               woothee_rule_name(i), woothee_stats_rules(stats)[i].hits);
+  }
+  if (status_rule_timing) {
+    ap_rputs("# TYPE woothee_rule_nanoseconds_total counter\n", r);
+    for (i = 0; i < woothee_rule_size(); i++) {
+      ap_rprintf(r, "woothee_rule_nanoseconds_total{rule=\"%s\"} %llu\n",
+                 woothee_rule_name(i), woothee_stats_rules(stats)[i].nsec);
+    }
+  }
+  ap_rputs("# TYPE woothee_rule_depth_total counter\n", r);
+  for (i = 0; i < woothee_rule_size(); i++) {
+    ap_rprintf(r, "woothee_rule_depth_total{rule=\"%s\"} %llu\n",
+               woothee_rule_name(i), woothee_stats_rules(stats)[i].depth);
+  }
+}
 
-            /* modified version of logic in ap_get_token() */
-            while (*val) {
-              const char *tok_start;
+static int
+woothee_topk_compare(const void *a, const void *b)
+{
+  const woothee_topk_entry *x = a, *y = b;
 
-              while (apr_isspace(*val)) {
-                ++val;
-              }
-              tok_start = val;
+  if (x->count != y->count) {
+    return (x->count < y->count) ? 1 : -1;
+  }
+  return (x->error > y->error) - (x->error < y->error);
+}
 
-              while (*val && *val != ',') {
-                if (*val++ == '"') {
-                  while (*val) {
-                    if (*val++ == '"') {
-                      break;
-                    }
-                  }
-                }
-              }
+/* copy of the sketch entries, most counted first */
+static woothee_topk_entry *
+woothee_topk_snapshot(request_rec *r, apr_uint32_t *n)
+{
+  woothee_topk_entry *entries;
+  apr_status_t rv;
+
+  rv = apr_global_mutex_lock(topk_mutex);
+  if (rv != APR_SUCCESS) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                  "failed to lock the woothee top User-Agents");
+    *n = 0;
+    return NULL;
+  }
 
-              if (new_val_len == (apr_size_t)(val - tok_start)
-                  && !strncmp(tok_start, new_val, new_val_len)) {
-                tok_found = 1;
-                break;
-              }
+  *n = topk->size;
+  entries = apr_pmemdup(r->pool, topk->entries,
+                        sizeof(woothee_topk_entry) * (*n ? *n : 1));
 
-              if (*val) {
-                ++val;
-              }
-            }
+  apr_global_mutex_unlock(topk_mutex);
 
-            if (!tok_found) {
-              apr_table_mergen(headers, hdr->header, new_val);
-            }
-          }
-          break;
-        case hdr_set:
-          apr_table_setn(headers, hdr->header,
-                         woothee_process_item(hdr, r, woothee));
-          break;
-        case hdr_setifempty:
-          if (NULL == apr_table_get(headers, hdr->header)) {
-            apr_table_setn(headers, hdr->header,
-                           woothee_process_item(hdr, r, woothee));
-          }
-          break;
-        case hdr_note:
-          apr_table_setn(r->notes, woothee_process_item(hdr, r, woothee),
-                         apr_table_get(headers, hdr->header));
-          break;
-      }
-    }
-  }
+  qsort(entries, *n, sizeof(woothee_topk_entry), woothee_topk_compare);
 
-  woothee_delete(woothee);
+  return entries;
+}
 
-  return 1;
+static void
+woothee_status_topk(request_rec *r, int counts)
+{
+  woothee_topk_entry *entries;
+  apr_uint32_t i, n;
+
+  entries = woothee_topk_snapshot(r, &n);
+  for (i = 0; i < n; i++) {
+    if (counts) {
+      ap_rprintf(r, "Top[%u]: %" APR_UINT64_T_FMT " (+-%" APR_UINT64_T_FMT
+                 ") %s\n", i + 1, entries[i].count, entries[i].error,
+                 entries[i].ua);
+    }
+    else {
+      ap_rprintf(r, "%s\n", entries[i].ua);
+    }
+  }
 }
 
-static apr_status_t
-ap_woothee_fixup(request_rec *r)
+static int
+woothee_status_handler(request_rec *r)
 {
-  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
-                                               &woothee_module);
+  if (strcmp(r->handler, "woothee-status")) {
+    return DECLINED;
+  }
 
-  /* do the fixup */
-  if (dirconf->fixup_in->nelts) {
-    do_woothee_fixup(r, r->headers_in, dirconf->fixup_in, 0);
+  r->allowed |= (AP_METHOD_BIT << M_GET);
+  if (r->method_number != M_GET) {
+    return DECLINED;
   }
 
-  return DECLINED;
+  /* ?top lists the User-Agents alone, one per line, as a warm file */
+  if (r->args && strcmp(r->args, "top") == 0) {
+    if (!topk) {
+      ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                    "woothee-status?top requires WootheeTopUserAgents");
+      return HTTP_NOT_FOUND;
+    }
+
+    ap_set_content_type(r, "text/plain; charset=ISO-8859-1");
+    if (!r->header_only) {
+      woothee_status_topk(r, 0);
+    }
+    return OK;
+  }
+
+  if (!status_slots) {
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
+                  "woothee-status requires WootheeStatus On");
+    return HTTP_NOT_FOUND;
+  }
+
+  ap_set_content_type(r, "text/plain; charset=ISO-8859-1");
+  if (r->header_only) {
+    return OK;
+  }
+
+  if (r->args && ap_strstr_c(r->args, "prometheus")) {
+    woothee_status_prometheus(r, woothee_stats_sum(r->pool));
+    if (topk) {
+      ap_rputs("# TYPE woothee_distinct_user_agents gauge\n", r);
+      ap_rprintf(r, "woothee_distinct_user_agents %.0f\n",
+                 woothee_hll_estimate());
+    }
+  }
+  else {
+    woothee_status_text(r, woothee_stats_sum(r->pool));
+    if (topk) {
+      ap_rprintf(r, "DistinctUserAgents: %.0f\n", woothee_hll_estimate());
+      woothee_status_topk(r, 1);
+    }
+  }
+
+  return OK;
 }
 
-static apr_status_t
-ap_woothee_early(request_rec *r)
+/* add a woothee section to mod_status' server-status page */
+static int
+woothee_status_hook(request_rec *r, int flags)
 {
-  woothee_conf *dirconf = ap_get_module_config(r->per_dir_config,
-                                               &woothee_module);
+  woothee_stats *stats;
+  int i;
 
-  /* do the fixup */
-  if (dirconf->fixup_in->nelts) {
-    if (!do_woothee_fixup(r, r->headers_in, dirconf->fixup_in, 1)) {
-      ap_log_rerror(APLOG_MARK, APLOG_CRIT, 0, r, APLOGNO(01504)
-                    "Regular expression replacement failed "
-                    "(replacement too long?)");
-      return HTTP_INTERNAL_SERVER_ERROR;
-    }
+  if (!status_slots) {
+    return OK;
   }
 
-  return DECLINED;
+  stats = woothee_stats_sum(r->pool);
+
+  if (flags & AP_STATUS_SHORT) {
+    ap_rprintf(r, "WootheeRequests: %" APR_UINT64_T_FMT "\n",
+               stats->requests);
+    ap_rprintf(r, "WootheeParses: %" APR_UINT64_T_FMT "\n", stats->parses);
+    ap_rprintf(r, "WootheeParseMicroseconds: %" APR_UINT64_T_FMT "\n",
+               stats->parse_usec);
+    ap_rprintf(r, "WootheeCacheHits: %" APR_UINT64_T_FMT "\n",
+               stats->cache_hits);
+    return OK;
+  }
+
+  ap_rputs("<hr />\n<h2>woothee</h2>\n<dl>\n", r);
+  ap_rprintf(r, "<dt>Requests: %" APR_UINT64_T_FMT ", excluded %"
+             APR_UINT64_T_FMT "</dt>\n", stats->requests, stats->excluded);
+  ap_rprintf(r, "<dt>Parses: %" APR_UINT64_T_FMT ", %" APR_UINT64_T_FMT
+             " us total, %" APR_UINT64_T_FMT " from client hints</dt>\n",
+             stats->parses, stats->parse_usec, stats->client_hints);
+  ap_rprintf(r, "<dt>Result reuse: %" APR_UINT64_T_FMT " hits, %"
+             APR_UINT64_T_FMT " misses</dt>\n",
+             stats->cache_hits, stats->cache_misses);
+  for (i = 0; i < WOOTHEE_CATEGORY_SIZE; i++) {
+    ap_rprintf(r, "<dt>%s: %" APR_UINT64_T_FMT "</dt>\n",
+               woothee_category_name(i), stats->categories[i]);
+  }
+  ap_rputs("</dl>\n", r);
+
+  if (flags & AP_STATUS_NOTABLE) {
+    return OK;
+  }
+
+  ap_rputs("<table border=\"0\"><tr><th>Rule</th><th>Calls</th>"
+           "<th>Hits</th><th>ns/call</th><th>Avg depth</th></tr>\n", r);
+  for (i = 0; i < woothee_rule_size(); i++) {
+    const woothee_rule_stat_t *rule = &woothee_stats_rules(stats)[i];
+    ap_rprintf(r, "<tr><td>%s</td><td>%llu</td><td>%llu</td>"
+               "<td>%s</td><td>%.1f</td></tr>\n",
+               woothee_rule_name(i), rule->calls, rule->hits,
+               !status_rule_timing ? "-"
+               : apr_psprintf(r->pool, "%llu", rule->calls
+                              ? rule->nsec / rule->calls : 0),
+               rule->hits ? (double)rule->depth / rule->hits : 0.0);
+  }
+  ap_rputs("</table>\n", r);
+
+  return OK;
 }
 
 static const command_rec woothee_cmds[] =
@@ -486,6 +2976,56 @@ static const command_rec woothee_cmds[] =
   AP_INIT_FLAG("RequestHeaderForWootheeEnable",
                header_set, NULL, RSRC_CONF | OR_FILEINFO,
                "set request header by woothe"),
+  AP_INIT_FLAG("WootheeClientHints",
+               client_hints_set, NULL, RSRC_CONF | OR_FILEINFO,
+               "use Sec-CH-UA client hints in place of the User-Agent "
+               "when present"),
+  AP_INIT_FLAG("WootheeAcceptClientHints",
+               accept_client_hints_set, NULL, RSRC_CONF | OR_FILEINFO,
+               "send Accept-CH asking for the client hints woothee uses"),
+  AP_INIT_TAKE3("WootheeCrawlerRateLimit",
+                ratelimit_cmd, NULL, RSRC_CONF,
+                "a woothee name or category, requests per second and burst"),
+  AP_INIT_TAKE2("WootheeRoute",
+                route_cmd, NULL, RSRC_CONF,
+                "a woothee name, category or * and the route to set"),
+  AP_INIT_TAKE1("WootheeRouteEnv",
+                route_env_cmd, NULL, RSRC_CONF,
+                "environment variable set by WootheeRoute "
+                "(default WOOTHEE_ROUTE)"),
+  AP_INIT_TAKE1("WootheeCacheKey",
+                cache_key_cmd, NULL, RSRC_CONF,
+                "request header set to a category|os|major-version key, "
+                "replacing User-Agent in Vary"),
+  AP_INIT_TAKE1("WootheeStatus",
+                status_cmd, NULL, RSRC_CONF,
+                "count woothee parses per worker for the woothee-status "
+                "handler and mod_status: On, Off or Rules to time each "
+                "challenge rule as well"),
+  AP_INIT_FLAG("WootheeAdaptiveOrder",
+               adaptive_order_cmd, NULL, RSRC_CONF,
+               "try the woothee challenges most frequent first, with the "
+               "same results"),
+  AP_INIT_ITERATE("WootheeDisableGroups",
+                  disable_groups_cmd, NULL, RSRC_CONF,
+                  "woothee challenge groups never tried: crawler, browser, "
+                  "os, mobilephone, appliance, misc or rare_cases"),
+  AP_INIT_TAKE_ARGV("WootheeTrustUpstream",
+                    trust_upstream_cmd, NULL, RSRC_CONF,
+                    "a header prefix (X-Woothee-For-) and the addresses or "
+                    "CIDRs of front tiers whose woothee headers are used"),
+  AP_INIT_TAKE1("WootheeTopUserAgents",
+                topk_cmd, NULL, RSRC_CONF,
+                "number of most frequent User-Agents tracked for "
+                "woothee-status"),
+  AP_INIT_TAKE1("WootheeSlowLog",
+                slow_log_cmd, NULL, RSRC_CONF,
+                "log User-Agents whose parse takes at least this many "
+                "microseconds"),
+  AP_INIT_ITERATE("WootheeExclude",
+                  exclude_cmd, NULL, RSRC_CONF,
+                  "URL prefixes (/static/) or suffixes (*.js) for which "
+                  "woothee is skipped"),
   AP_INIT_RAW_ARGS("RequestHeaderForWoothee",
                    header_cmd, &hdr_in, OR_FILEINFO,
                    "an action, header and item followed by optional env "
@@ -493,29 +3033,464 @@ static const command_rec woothee_cmds[] =
   {NULL}
 };
 
+/* create zeroed shared memory, falling back to a name in the runtime dir */
+static void *
+woothee_shm_create(apr_pool_t *pconf, server_rec *s, apr_size_t size,
+                   const char *name)
+{
+  apr_shm_t *shm;
+  apr_status_t rv;
+  void *base;
+
+  rv = apr_shm_create(&shm, size, NULL, pconf);
+  if (APR_STATUS_IS_ENOTIMPL(rv)) {
+    const char *fname = ap_runtime_dir_relative(pconf, name);
+    apr_shm_remove(fname, pconf);
+    rv = apr_shm_create(&shm, size, fname, pconf);
+  }
+  if (rv != APR_SUCCESS) {
+    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                 "failed to create woothee shared memory %s", name);
+    return NULL;
+  }
+
+  base = apr_shm_baseaddr_get(shm);
+  memset(base, 0, size);
+
+  return base;
+}
+
 static int
 header_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                    apr_pool_t *ptemp, server_rec *s)
 {
+  woothee_server_conf *sconf;
+  int i;
+
   header_ssl_lookup = APR_RETRIEVE_OPTIONAL_FN(ssl_var_lookup);
+
+  ratelimit_tat = NULL;
+  status_slots = NULL;
+  topk = NULL;
+  topk_mutex = NULL;
+
+  dataset_names = apr_hash_make(pconf);
+  for (i = 0; i < woothee_dataset_size(); i++) {
+    int *index = apr_palloc(pconf, sizeof(*index));
+    *index = i;
+    apr_hash_set(dataset_names, woothee_dataset_at(i)->name,
+                 APR_HASH_KEY_STRING, index);
+  }
+
+  sconf = ap_get_module_config(s->module_config, &woothee_module);
+
+  woothee_groups_disable(sconf->disabled_groups);
+
+  /* two clock reads per challenge, only when asked for */
+  status_rule_timing = (sconf->status == WOOTHEE_STATUS_RULES);
+  woothee_rule_timing(status_rule_timing);
+
+  if (sconf->ratelimits) {
+    ratelimit_tat = woothee_shm_create(pconf, s, sizeof(apr_uint32_t)
+                                       * woothee_dataset_size(),
+                                       "woothee-ratelimit");
+    if (!ratelimit_tat) {
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ratelimit_epoch = apr_time_now();
+  }
+
+  if (sconf->topk) {
+    apr_uint32_t slots = 2;
+    apr_status_t rv;
+
+    while (slots < 2 * (apr_uint32_t)sconf->topk) {
+      slots <<= 1;
+    }
+
+    topk = woothee_shm_create(pconf, s, APR_OFFSETOF(woothee_topk, entries)
+                              + sizeof(woothee_topk_entry) * sconf->topk
+                              + sizeof(apr_uint32_t) * slots,
+                              "woothee-topk");
+    if (!topk) {
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    topk->mask = slots - 1;
+    topk_k = sconf->topk;
+
+    rv = ap_global_mutex_create(&topk_mutex, NULL, topk_mutex_type, NULL,
+                                s, pconf, 0);
+    if (rv != APR_SUCCESS) {
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+
+  if (sconf->status) {
+    int daemons = 1, threads = 1;
+
+    ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &daemons);
+    ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &threads);
+    if (daemons < 1) {
+      daemons = 1;
+    }
+    if (threads < 1) {
+      threads = 1;
+    }
+
+    /* a cache line per slot keeps workers from sharing one */
+    status_rules_offset = APR_ALIGN(sizeof(woothee_stats)
+                                    + sizeof(apr_uint64_t)
+                                    * (woothee_dataset_size() + 1), 8);
+    status_slot_size = APR_ALIGN(status_rules_offset
+                                 + sizeof(woothee_rule_stat_t)
+                                 * woothee_rule_size(), 64);
+    status_thread_limit = threads;
+    status_nslots = daemons * threads;
+
+    status_slots = woothee_shm_create(pconf, s,
+                                      status_slot_size * status_nslots,
+                                      "woothee-status");
+    if (!status_slots) {
+      return HTTP_INTERNAL_SERVER_ERROR;
+    }
+  }
+
   return OK;
 }
 
+static apr_status_t
+woothee_order_cleanup(void *data)
+{
+  int i;
+
+  for (i = 0; i < adaptive_threads; i++) {
+    woothee_order_delete(adaptive_orders[i]);
+  }
+  adaptive_orders = NULL;
+  adaptive_threads = 0;
+
+  return APR_SUCCESS;
+}
+
+/*
+ * Expression routines
+ */
+
+/* %{WOOTHEE_*} variables, the values of the per-request result */
+static const char *expr_vars[] = {
+  "WOOTHEE_NAME", "WOOTHEE_CATEGORY", "WOOTHEE_OS", "WOOTHEE_OS_VERSION",
+  "WOOTHEE_VERSION", "WOOTHEE_VENDOR", NULL
+};
+static const unsigned int expr_var_fields[] = {
+  WOOTHEE_FIELD_NAME, WOOTHEE_FIELD_CATEGORY, WOOTHEE_FIELD_OS,
+  WOOTHEE_FIELD_OS_VERSION, WOOTHEE_FIELD_VERSION, WOOTHEE_FIELD_VENDOR
+};
+
+static const char *
+woothee_expr_var(ap_expr_eval_ctx_t *ctx, const void *data)
+{
+  int i = (const char **)data - expr_vars;
+  woothee_t *woothee;
+
+  if (!ctx->r
+      || !(woothee = woothee_request_fields(ctx->r, expr_var_fields[i]))) {
+    return "";
+  }
+
+  /* not copied: the operators below know these strings by address */
+  switch (i) {
+    case 0:
+      return woothee->name;
+    case 1:
+      return woothee->category;
+    case 2:
+      return woothee->os;
+    case 3:
+      return woothee->os_version;
+    case 4:
+      return woothee->version;
+    case 5:
+      return woothee->vendor;
+  }
+
+  return "";
+}
+
+/*
+ * The numbers of a version operand. A %{WOOTHEE_VERSION} or
+ * %{WOOTHEE_OS_VERSION} operand is the result's own string, whose numbers
+ * were split when it was parsed.
+ */
+static int
+woothee_expr_version(ap_expr_eval_ctx_t *ctx, const char *arg, int *v)
+{
+  woothee_request *req = NULL;
+
+  if (ctx->r) {
+    req = ap_get_module_config(ctx->r->request_config, &woothee_module);
+  }
+  if (req && req->woothee) {
+    woothee_t *woothee = req->woothee;
+    if (arg == woothee->version) {
+      v[0] = woothee->version_major;
+      v[1] = woothee->version_minor;
+      v[2] = woothee->version_patch;
+      return v[0] >= 0;
+    } else if (arg == woothee->os_version) {
+      v[0] = woothee->os_version_major;
+      v[1] = woothee->os_version_minor;
+      v[2] = woothee->os_version_patch;
+      return v[0] >= 0;
+    }
+  }
+
+  return woothee_version_split(arg, &v[0], &v[1], &v[2]);
+}
+
+/*
+ * Compare two versions part by part, a missing part counting as 0.
+ * Returns 0 when either has no version number at all.
+ */
+static int
+woothee_expr_compare(ap_expr_eval_ctx_t *ctx, const char *arg1,
+                     const char *arg2, int *cmp)
+{
+  int v1[3], v2[3];
+  int i;
+
+  if (!woothee_expr_version(ctx, arg1, v1)
+      || !woothee_expr_version(ctx, arg2, v2)) {
+    return 0;
+  }
+
+  *cmp = 0;
+  for (i = 0; i < 3 && *cmp == 0; i++) {
+    int a = v1[i] < 0 ? 0 : v1[i];
+    int b = v2[i] < 0 ? 0 : v2[i];
+    *cmp = (a > b) - (a < b);
+  }
+
+  return 1;
+}
+
+#define WOOTHEE_EXPR_OP(op, test)                                       \
+  static int                                                            \
+  woothee_expr_##op(ap_expr_eval_ctx_t *ctx, const void *data,          \
+                    const char *arg1, const char *arg2)                 \
+  {                                                                     \
+    int cmp;                                                            \
+    if (!woothee_expr_compare(ctx, arg1, arg2, &cmp)) {                 \
+      return 0;                                                         \
+    }                                                                   \
+    return test;                                                        \
+  }
+
+WOOTHEE_EXPR_OP(eq, cmp == 0)
+WOOTHEE_EXPR_OP(ne, cmp != 0)
+WOOTHEE_EXPR_OP(lt, cmp < 0)
+WOOTHEE_EXPR_OP(le, cmp <= 0)
+WOOTHEE_EXPR_OP(gt, cmp > 0)
+WOOTHEE_EXPR_OP(ge, cmp >= 0)
+
+static const struct {
+  const char *name;
+  ap_expr_op_binary_t *func;
+} expr_ops[] = {
+  { "wver_eq", woothee_expr_eq },
+  { "wver_ne", woothee_expr_ne },
+  { "wver_lt", woothee_expr_lt },
+  { "wver_le", woothee_expr_le },
+  { "wver_gt", woothee_expr_gt },
+  { "wver_ge", woothee_expr_ge },
+  { NULL, NULL }
+};
+
+static int
+woothee_expr_lookup(ap_expr_lookup_parms *parms)
+{
+  int i;
+
+  switch (parms->type) {
+    case AP_EXPR_FUNC_VAR:
+      for (i = 0; expr_vars[i]; i++) {
+        if (strcasecmp(expr_vars[i], parms->name) == 0) {
+          *parms->func = woothee_expr_var;
+          *parms->data = &expr_vars[i];
+          if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_RUN_MPM) {
+            expr_fields |= expr_var_fields[i];
+          }
+          return OK;
+        }
+      }
+      break;
+    case AP_EXPR_FUNC_OP_BINARY:
+      for (i = 0; expr_ops[i].name; i++) {
+        if (strcasecmp(expr_ops[i].name, parms->name) == 0) {
+          *parms->func = expr_ops[i].func;
+          *parms->data = NULL;
+          return OK;
+        }
+      }
+      break;
+  }
+
+  return DECLINED;
+}
+
+/*
+ * Rewrite map routines
+ */
+
+/*
+ * The result for a map key: the key is normally %{HTTP_USER_AGENT}, which
+ * is answered from the per-request result, any other key is parsed on its
+ * own.
+ */
+static char *
+woothee_mapfunc(request_rec *r, char *key, apr_size_t offset,
+                unsigned int field)
+{
+  const char *ua = apr_table_get(r->headers_in, "User-Agent");
+  woothee_t *woothee;
+  char *value = NULL;
+
+  if (!key || !*key || (ua && strcmp(key, ua) == 0)) {
+    woothee = woothee_request_fields(r, field);
+    if (woothee) {
+      value = *(char **)((char *)woothee + offset);
+    }
+    return value ? apr_pstrdup(r->pool, value) : NULL;
+  }
+
+  woothee = woothee_parse_fields(key, field);
+  if (woothee) {
+    value = *(char **)((char *)woothee + offset);
+    value = value ? apr_pstrdup(r->pool, value) : NULL;
+    woothee_delete(woothee);
+  }
+
+  return value;
+}
+
+#define WOOTHEE_MAPFUNC(item, field)                                    \
+  static char *                                                         \
+  woothee_mapfunc_##item(request_rec *r, char *key)                     \
+  {                                                                     \
+    return woothee_mapfunc(r, key, APR_OFFSETOF(woothee_t, item),       \
+                           WOOTHEE_FIELD_##field);                      \
+  }
+
+WOOTHEE_MAPFUNC(name, NAME)
+WOOTHEE_MAPFUNC(category, CATEGORY)
+WOOTHEE_MAPFUNC(os, OS)
+WOOTHEE_MAPFUNC(os_version, OS_VERSION)
+WOOTHEE_MAPFUNC(version, VERSION)
+WOOTHEE_MAPFUNC(vendor, VENDOR)
+
+static int
+woothee_pre_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp)
+{
+  APR_OPTIONAL_FN_TYPE(ap_register_rewrite_mapfunc) *map_register;
+
+  expr_fields = 0;
+
+  /* int:woothee_* maps must exist before RewriteMap is read */
+  map_register = APR_RETRIEVE_OPTIONAL_FN(ap_register_rewrite_mapfunc);
+  if (map_register) {
+    map_register("woothee_name", woothee_mapfunc_name);
+    map_register("woothee_category", woothee_mapfunc_category);
+    map_register("woothee_os", woothee_mapfunc_os);
+    map_register("woothee_os_version", woothee_mapfunc_os_version);
+    map_register("woothee_version", woothee_mapfunc_version);
+    map_register("woothee_vendor", woothee_mapfunc_vendor);
+  }
+
+  return ap_mutex_register(pconf, topk_mutex_type, NULL, APR_LOCK_DEFAULT, 0);
+}
+
+static void
+woothee_child_init(apr_pool_t *p, server_rec *s)
+{
+  woothee_server_conf *sconf;
+  int i, threads = 1;
+
+  if (topk_mutex) {
+    apr_status_t rv = apr_global_mutex_child_init(
+      &topk_mutex, apr_global_mutex_lockfile(topk_mutex), p);
+    if (rv != APR_SUCCESS) {
+      ap_log_error(APLOG_MARK, APLOG_ERR, rv, s,
+                   "failed to attach the woothee top User-Agents mutex");
+      topk = NULL;
+    }
+  }
+
+  sconf = ap_get_module_config(s->module_config, &woothee_module);
+  if (!sconf->adaptive_order) {
+    return;
+  }
+
+  ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &threads);
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  adaptive_orders = apr_pcalloc(p, sizeof(woothee_order_t *) * threads);
+  for (i = 0; i < threads; i++) {
+    adaptive_orders[i] = woothee_order_create(WOOTHEE_ORDER_PERIOD);
+    if (!adaptive_orders[i]) {
+      break;
+    }
+  }
+  adaptive_threads = i;
+
+  apr_pool_cleanup_register(p, NULL, woothee_order_cleanup,
+                            apr_pool_cleanup_null);
+}
+
 static void
 register_hooks(apr_pool_t *p)
 {
+  ap_hook_pre_config(woothee_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
   ap_hook_post_config(header_post_config,NULL,NULL,APR_HOOK_MIDDLE);
+  ap_hook_child_init(woothee_child_init, NULL, NULL, APR_HOOK_MIDDLE);
   ap_hook_fixups(ap_woothee_fixup, NULL, NULL, APR_HOOK_LAST);
   ap_hook_post_read_request(ap_woothee_early, NULL, NULL, APR_HOOK_FIRST);
+  ap_hook_post_read_request(ap_woothee_ratelimit, NULL, NULL, APR_HOOK_FIRST);
+  ap_hook_insert_filter(woothee_insert_filter, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_handler(woothee_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_expr_lookup(woothee_expr_lookup, NULL, NULL, APR_HOOK_MIDDLE);
+  APR_OPTIONAL_HOOK(ap, status_hook, woothee_status_hook, NULL, NULL,
+                    APR_HOOK_MIDDLE);
+
+  /* runs before CACHE_SAVE (AP_FTYPE_CONTENT_SET + 1) sees the headers */
+  ap_register_output_filter("WOOTHEE_VARY", woothee_vary_filter, NULL,
+                            AP_FTYPE_CONTENT_SET);
+  /* and after it, for the Vary the client gets */
+  ap_register_output_filter("WOOTHEE_VARY_RESTORE",
+                            woothee_vary_restore_filter, NULL,
+                            AP_FTYPE_CONTENT_SET + 2);
+
+  ap_register_auth_provider(p, AUTHZ_PROVIDER_GROUP, "woothee-category",
+                            AUTHZ_PROVIDER_VERSION,
+                            &authz_woothee_category_provider,
+                            AP_AUTH_INTERNAL_PER_CONF);
+  ap_register_auth_provider(p, AUTHZ_PROVIDER_GROUP, "woothee-name",
+                            AUTHZ_PROVIDER_VERSION,
+                            &authz_woothee_name_provider,
+                            AP_AUTH_INTERNAL_PER_CONF);
+  ap_register_auth_provider(p, AUTHZ_PROVIDER_GROUP, "woothee-crawler",
+                            AUTHZ_PROVIDER_VERSION,
+                            &authz_woothee_crawler_provider,
+                            AP_AUTH_INTERNAL_PER_CONF);
 }
 
 AP_DECLARE_MODULE(woothee) =
 {
   STANDARD20_MODULE_STUFF,
-  create_woothee_dir_config,  /* dir config creater */
-  merge_woothee_config,       /* dir merger --- default is to override */
-  NULL,                       /* server config */
-  NULL,                       /* merge server configs */
-  woothee_cmds,               /* command apr_table_t */
-  register_hooks              /* register hooks */
+  create_woothee_dir_config,    /* dir config creater */
+  merge_woothee_config,         /* dir merger --- default is to override */
+  create_woothee_server_config, /* server config */
+  merge_woothee_server_config,  /* merge server configs */
+  woothee_cmds,                 /* command apr_table_t */
+  register_hooks                /* register hooks */
 };
@@ -0,0 +1,161 @@
+/*
+ * woothee_parse_adaptive() must give the results of woothee_parse() for
+ * any order it settles on. The useragents of tests/useragents.txt are
+ * parsed with several order periods, in passes that skew the hits
+ * towards different rules, and every field is compared.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "woothee.h"
+
+#define LINE_MAX_SIZE 4096
+#define PASSES 8
+
+static int
+compare(const woothee_t *a, const woothee_t *b, const char *ua,
+        unsigned int period)
+{
+  static const struct {
+    const char *name;
+    size_t offset;
+  } strings[] = {
+    { "name", offsetof(woothee_t, name) },
+    { "category", offsetof(woothee_t, category) },
+    { "os", offsetof(woothee_t, os) },
+    { "os_version", offsetof(woothee_t, os_version) },
+    { "version", offsetof(woothee_t, version) },
+    { "vendor", offsetof(woothee_t, vendor) },
+    { NULL, 0 }
+  };
+  int i, failed = 0;
+
+  for (i = 0; strings[i].name; i++) {
+    const char *x = *(char * const *)((const char *)a + strings[i].offset);
+    const char *y = *(char * const *)((const char *)b + strings[i].offset);
+    if (strcmp(x, y) != 0) {
+      printf("FAIL period %u %s %s != %s: %s\n",
+             period, strings[i].name, y, x, ua);
+      failed++;
+    }
+  }
+
+  if (a->version_major != b->version_major
+      || a->version_minor != b->version_minor
+      || a->version_patch != b->version_patch
+      || a->os_version_major != b->os_version_major
+      || a->os_version_minor != b->os_version_minor
+      || a->os_version_patch != b->os_version_patch) {
+    printf("FAIL period %u version numbers: %s\n", period, ua);
+    failed++;
+  }
+
+  return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+  static const unsigned int periods[] = { 1, 3, 64, 1024 };
+  static char line[LINE_MAX_SIZE];
+  const char *srcdir = getenv("srcdir");
+  char path[LINE_MAX_SIZE];
+  char **uas = NULL;
+  woothee_t **expected;
+  woothee_rule_stat_t *stats;
+  size_t n = 0, capacity = 0, i;
+  int p, pass, repeat, failed = 0, hit = 0;
+  FILE *fp;
+
+  if (argc > 1) {
+    snprintf(path, sizeof(path), "%s", argv[1]);
+  } else {
+    snprintf(path, sizeof(path), "%s/tests/useragents.txt",
+             srcdir ? srcdir : ".");
+  }
+
+  fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!*line) {
+      continue;
+    }
+    if (n >= capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      uas = realloc(uas, sizeof(char *) * capacity);
+      if (!uas) {
+        return 1;
+      }
+    }
+    uas[n++] = strdup(line);
+  }
+  fclose(fp);
+
+  expected = calloc(n, sizeof(woothee_t *));
+  stats = calloc(woothee_rule_size(), sizeof(woothee_rule_stat_t));
+  if (!expected || !stats) {
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    expected[i] = woothee_parse(uas[i]);
+    if (!expected[i]) {
+      printf("FAIL woothee_parse: %s\n", uas[i]);
+      return 1;
+    }
+  }
+
+  for (p = 0; p < (int)(sizeof(periods) / sizeof(periods[0])); p++) {
+    woothee_order_t *order = woothee_order_create(periods[p]);
+
+    if (!order) {
+      return 1;
+    }
+
+    /* each pass repeats a different subset, so the order keeps moving */
+    for (pass = 0; pass < PASSES; pass++) {
+      for (i = 0; i < n; i++) {
+        size_t j = (pass & 1) ? n - 1 - i : i;
+
+        for (repeat = (j % (pass + 2)) ? 1 : 8; repeat > 0; repeat--) {
+          woothee_t *woothee
+            = woothee_parse_adaptive(uas[j], order, (pass & 2) ? stats : NULL,
+                                     WOOTHEE_FIELD_ALL);
+          if (!woothee) {
+            printf("FAIL woothee_parse_adaptive: %s\n", uas[j]);
+            return 1;
+          }
+          failed += compare(expected[j], woothee, uas[j], periods[p]);
+          woothee_delete(woothee);
+        }
+      }
+    }
+
+    woothee_order_delete(order);
+  }
+
+  for (p = 0; p < woothee_rule_size(); p++) {
+    if (stats[p].hits) {
+      hit++;
+    }
+  }
+
+  printf("%zu useragents, %d of %d rules hit, %d failures\n",
+         n, hit, woothee_rule_size(), failed);
+
+  for (i = 0; i < n; i++) {
+    woothee_delete(expected[i]);
+    free(uas[i]);
+  }
+  free(expected);
+  free(stats);
+  free(uas);
+
+  return failed ? 1 : 0;
+}
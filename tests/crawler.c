@@ -0,0 +1,80 @@
+/*
+ * Require woothee-crawler answers from woothee_maybe_crawler() alone; it
+ * must agree with woothee_parse() on every crawler the parse finds
+ * without a browser or os match.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "woothee.h"
+
+static const struct {
+  const char *ua;
+  int is_crawler;    /* woothee_is_crawler() */
+  int maybe_crawler; /* woothee_maybe_crawler() */
+  const char *name;  /* woothee_parse() */
+} cases[] = {
+  { "Mozilla/5.0 (compatible; Googlebot/2.1; "
+    "+http://www.google.com/bot.html)", 1, 1, "Googlebot" },
+  { "Mozilla/5.0 (compatible; bingbot/2.0; "
+    "+http://www.bing.com/bingbot.htm)", 1, 1, "bingbot" },
+  /* VariousCrawler */
+  { "Mozilla/5.0 (compatible; FooSpider/1.0)", 0, 1, "misc crawler" },
+  { "foo-crawler/2.3 (+http://example.com/crawler.html)",
+    0, 1, "misc crawler" },
+  { "Universal Feed Parser/5.2.1", 0, 1, "misc crawler" },
+  { "WatchDog/1.0", 0, 1, "misc crawler" },
+  { "ia_archiver (+http://www.alexa.com/site/help/webmasters)",
+    0, 1, "misc crawler" },
+  /* a token such as "Robot" is not one of the patterns */
+  { "Robots-Check 1.0", 0, 0, NULL },
+  /* nor a word ending in "bot", such as the CUBOT phones */
+  { "Mozilla/5.0 (Linux; Android 9; CUBOT X19) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Mobile Safari/537.36",
+    0, 0, "Chrome" },
+  { "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36", 0, 0, "Chrome" },
+  { NULL, 0, 0, NULL }
+};
+
+int
+main(void)
+{
+  int i, failed = 0;
+
+  for (i = 0; cases[i].ua; i++) {
+    const char *ua = cases[i].ua;
+    woothee_t *woothee;
+
+    if (woothee_is_crawler(ua) != cases[i].is_crawler) {
+      printf("FAIL woothee_is_crawler: %s\n", ua);
+      failed++;
+    }
+    if (woothee_maybe_crawler(ua) != cases[i].maybe_crawler) {
+      printf("FAIL woothee_maybe_crawler: %s\n", ua);
+      failed++;
+    }
+
+    woothee = woothee_parse(ua);
+    if (!woothee) {
+      printf("FAIL woothee_parse: %s\n", ua);
+      failed++;
+      continue;
+    }
+    if (cases[i].name && strcmp(woothee->name, cases[i].name) != 0) {
+      printf("FAIL name %s: %s\n", woothee->name, ua);
+      failed++;
+    }
+    if (cases[i].maybe_crawler
+        && strcmp(woothee->category, "crawler") != 0) {
+      printf("FAIL category %s: %s\n", woothee->category, ua);
+      failed++;
+    }
+    woothee_delete(woothee);
+  }
+
+  printf("%d cases, %d failures\n", i, failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * The fastpath must give the results of the challenges it stands in
+ * for. The shapes below, the platforms and products of its grammar
+ * combined, and the useragents of tests/useragents.txt are parsed with
+ * the fastpath on and off, under several field masks, and every field is
+ * compared. The shapes must be taken by the fastpath
+ * (or not) as the grammar in woothee/src/fastpath.c says.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "woothee.h"
+
+#define LINE_MAX_SIZE 4096
+
+static const struct {
+  const char *ua;
+  int fastpath; /* whether the fastpath takes it */
+} cases[] = {
+  /* bare Android majors leave os_version UNKNOWN, x.y[.z] set it */
+  { "Mozilla/5.0 (Linux; Android 10; K) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Mobile Safari/537.36", 1 },
+  { "Mozilla/5.0 (Linux; Android 13.1.2; K) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Mobile Safari/537.36", 1 },
+  /* Chromium Edge stays Chrome, EdgeHTML is Edge */
+  { "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36 "
+    "Edg/120.0.2210.91", 1 },
+  { "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/70.0.3538.102 Safari/537.36 "
+    "Edge/18.19582", 1 },
+  /* Mobile/ build ids */
+  { "Mozilla/5.0 (iPhone; CPU iPhone OS 17_1 like Mac OS X) "
+    "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.1 "
+    "Mobile/15E148 Safari/604.1", 1 },
+  { "Mozilla/5.0 (iPad; CPU OS 16_6_1 like Mac OS X) "
+    "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/16.6 "
+    "Mobile/15E148 Safari/604.1", 1 },
+  /* 10_x and 10.x Mac forms */
+  { "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) "
+    "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 "
+    "Safari/537.36", 1 },
+  { "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15) "
+    "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.1 "
+    "Safari/605.1.15", 1 },
+  { "Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:120.0) "
+    "Gecko/20100101 Firefox/120.0", 1 },
+  { "Mozilla/5.0 (Windows NT 6.1; WOW64; rv:52.0) Gecko/20100101 "
+    "Firefox/52.0", 1 },
+  { "Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:120.0) Gecko/20100101 "
+    "Firefox/120.0", 1 },
+  /* other products are left to the challenges */
+  { "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36 OPR/105.0.0.0", 0 },
+  { "Mozilla/5.0 (iPhone; CPU iPhone OS 17_1 like Mac OS X) "
+    "AppleWebKit/605.1.15 (KHTML, like Gecko) CriOS/120.0.6099.119 "
+    "Mobile/15E148 Safari/604.1", 0 },
+  { "Mozilla/5.0 (Linux; Android 10; K) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Mobile Safari/537.36 "
+    "Googlebot", 0 },
+  { NULL, 0 }
+};
+
+/* every PLATFORM with every PRODUCT of the grammar, and with Firefox */
+static const char *platforms[] = {
+  "Windows NT 10.0; Win64; x64", "Windows NT 6.1; WOW64", "Windows NT 6.3",
+  "Windows NT 5.1", "Windows NT 4.0",
+  "Macintosh; Intel Mac OS X 10_15_7", "Macintosh; Intel Mac OS X 10_9",
+  "Macintosh; Intel Mac OS X 10.15", "Macintosh; Intel Mac OS X 11_0",
+  "X11; Linux x86_64", "X11; Ubuntu; Linux x86_64",
+  "Linux; Android 10; K", "Linux; Android 8.1.0; K", "Linux; Android 4.4",
+  "iPhone; CPU iPhone OS 17_1 like Mac OS X",
+  "iPad; CPU OS 16_6_1 like Mac OS X", "iPad; CPU OS 9 like Mac OS X",
+  NULL
+};
+
+static const char *products[] = {
+  "Chrome/120.0.0.0 Safari/537.36",
+  "Chrome/120.0.0.0 Mobile Safari/537.36",
+  "Chrome/120.0.0.0 Safari/537.36 Edg/120.0.2210.91",
+  "Chrome/70.0.3538.102 Safari/537.36 Edge/18.19582",
+  "Version/17.1 Safari/605.1.15",
+  "Version/17.1 Mobile/15E148 Safari/604.1",
+  "Version/4.0 Chrome/120.0.0.0 Mobile Safari/537.36",
+  "Chrome/120.0.0.0 Safari/537.36 OPR/105.0.0.0",
+  NULL
+};
+
+static int
+compare(const woothee_t *a, const woothee_t *b, const char *ua,
+        unsigned int fields)
+{
+  static const struct {
+    const char *name;
+    size_t offset;
+  } strings[] = {
+    { "name", offsetof(woothee_t, name) },
+    { "category", offsetof(woothee_t, category) },
+    { "os", offsetof(woothee_t, os) },
+    { "os_version", offsetof(woothee_t, os_version) },
+    { "version", offsetof(woothee_t, version) },
+    { "vendor", offsetof(woothee_t, vendor) },
+    { NULL, 0 }
+  };
+  int i, failed = 0;
+
+  for (i = 0; strings[i].name; i++) {
+    const char *x = *(char * const *)((const char *)a + strings[i].offset);
+    const char *y = *(char * const *)((const char *)b + strings[i].offset);
+    if (strcmp(x, y) != 0) {
+      printf("FAIL fields 0x%x %s %s != %s: %s\n",
+             fields, strings[i].name, y, x, ua);
+      failed++;
+    }
+  }
+
+  if (a->version_major != b->version_major
+      || a->version_minor != b->version_minor
+      || a->version_patch != b->version_patch
+      || a->os_version_major != b->os_version_major
+      || a->os_version_minor != b->os_version_minor
+      || a->os_version_patch != b->os_version_patch) {
+    printf("FAIL fields 0x%x version numbers: %s\n", fields, ua);
+    failed++;
+  }
+
+  return failed;
+}
+
+/* parse ua with the fastpath off and on, 1 when the results differ */
+static int
+check(const char *ua)
+{
+  static const unsigned int masks[] = {
+    WOOTHEE_FIELD_ALL,
+    WOOTHEE_FIELD_NAME | WOOTHEE_FIELD_CATEGORY | WOOTHEE_FIELD_OS,
+    WOOTHEE_FIELD_VERSION,
+    WOOTHEE_FIELD_OS_VERSION
+  };
+  woothee_t *expected, *woothee;
+  int m, failed = 0;
+
+  for (m = 0; m < (int)(sizeof(masks) / sizeof(masks[0])); m++) {
+    woothee_fastpath_enable(0);
+    expected = woothee_parse_fields(ua, masks[m]);
+    woothee_fastpath_enable(1);
+    woothee = woothee_parse_fields(ua, masks[m]);
+    if (!expected || !woothee) {
+      printf("FAIL woothee_parse_fields: %s\n", ua);
+      failed++;
+    } else {
+      failed += compare(expected, woothee, ua, masks[m]);
+    }
+    woothee_delete(expected);
+    woothee_delete(woothee);
+  }
+
+  return failed ? 1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  static char line[LINE_MAX_SIZE];
+  const char *srcdir = getenv("srcdir");
+  char path[LINE_MAX_SIZE];
+  woothee_rule_stat_t *stats;
+  size_t n = 0;
+  int i, p, q, fastpath = -1, failed = 0;
+  FILE *fp;
+
+  if (argc > 1) {
+    snprintf(path, sizeof(path), "%s", argv[1]);
+  } else {
+    snprintf(path, sizeof(path), "%s/tests/useragents.txt",
+             srcdir ? srcdir : ".");
+  }
+
+  for (i = 0; i < woothee_rule_size(); i++) {
+    if (strcmp(woothee_rule_name(i), "fastpath") == 0) {
+      fastpath = i;
+    }
+  }
+  stats = calloc(woothee_rule_size(), sizeof(woothee_rule_stat_t));
+  if (fastpath < 0 || !stats) {
+    return 1;
+  }
+
+  for (i = 0; cases[i].ua; i++) {
+    unsigned long long hits = stats[fastpath].hits;
+
+    woothee_delete(woothee_parse_profiled(cases[i].ua, stats));
+    if ((stats[fastpath].hits != hits) != cases[i].fastpath) {
+      printf("FAIL fastpath %s: %s\n",
+             cases[i].fastpath ? "missed" : "taken", cases[i].ua);
+      failed++;
+    }
+    failed += check(cases[i].ua);
+  }
+
+  for (p = 0; platforms[p]; p++) {
+    for (q = 0; products[q]; q++) {
+      snprintf(line, sizeof(line), "Mozilla/5.0 (%s) AppleWebKit/537.36 "
+               "(KHTML, like Gecko) %s", platforms[p], products[q]);
+      woothee_delete(woothee_parse_profiled(line, stats));
+      failed += check(line);
+      n++;
+    }
+    snprintf(line, sizeof(line), "Mozilla/5.0 (%s; rv:120.0) "
+             "Gecko/20100101 Firefox/120.0", platforms[p]);
+    woothee_delete(woothee_parse_profiled(line, stats));
+    failed += check(line);
+    n++;
+  }
+
+  fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!*line) {
+      continue;
+    }
+    woothee_delete(woothee_parse_profiled(line, stats));
+    failed += check(line);
+    n++;
+  }
+  fclose(fp);
+
+  printf("%d cases, %zu useragents, %llu fastpath hits, %d failures\n",
+         i, n, stats[fastpath].hits, failed);
+
+  free(stats);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * woothee-batch: enrich the User-Agents of access logs with
+ * woothee_parse_batch_threads() and report how it scales with threads.
+ *
+ *   woothee-batch [-r] [-t threads,...] [-n runs] [file ...]
+ *
+ *   -r  each line is a User-Agent (default: the last quoted field of a
+ *       common/combined log line)
+ *   -t  thread counts to run (default: 1,2,4,8,16,32,64)
+ *   -n  runs per thread count, the fastest is reported (default: 3)
+ *
+ * Every line is kept, so the batch deduplicates as it would on a log;
+ * each run parses the whole batch from a cold result cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "woothee.h"
+#include "common.h"
+
+typedef struct {
+  char **ua;
+  size_t *len;
+  size_t size;
+  size_t capacity;
+} batch_lines_t;
+
+static void
+batch_add(void *data, const char *ua)
+{
+  batch_lines_t *lines = data;
+
+  if (lines->size >= lines->capacity) {
+    lines->capacity = lines->capacity ? lines->capacity * 2 : 4096;
+    lines->ua = tool_realloc(lines->ua, sizeof(char *) * lines->capacity);
+    lines->len = tool_realloc(lines->len, sizeof(size_t) * lines->capacity);
+  }
+  lines->len[lines->size] = strlen(ua);
+  lines->ua[lines->size] = strdup(ua);
+  if (!lines->ua[lines->size]) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  lines->size++;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-r] [-t threads,...] [-n runs] [file ...]\n", name);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const int default_threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+  int threads[64];
+  int nthreads = 0, raw = 0, runs = 3, i, t, run;
+  batch_lines_t lines;
+  woothee_result_t out;
+  double base = 0, best, start, elapsed;
+  size_t unique = 0;
+
+  memset(&lines, 0, sizeof(lines));
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      raw = 1;
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      char *list = argv[++i], *end;
+      while (*list && nthreads < 64) {
+        long n = strtol(list, &end, 10);
+        if (end == list || n < 1) {
+          usage(argv[0]);
+        }
+        threads[nthreads++] = (int)n;
+        list = (*end == ',') ? end + 1 : end;
+      }
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+      if (runs < 1) {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (tool_load_files(argc - i, argv + i, raw, batch_add, &lines) != 0) {
+    return 1;
+  }
+
+  if (lines.size == 0) {
+    fprintf(stderr, "ERROR: no User-Agent found\n");
+    return 1;
+  }
+
+  if (nthreads == 0) {
+    for (i = 0; i < (int)(sizeof(default_threads) / sizeof(int)); i++) {
+      threads[nthreads++] = default_threads[i];
+    }
+  }
+
+  printf("lines: %zu\n", lines.size);
+  printf("cpus: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+  printf("\n%7s %10s %14s %8s %11s\n",
+         "threads", "ms", "lines/sec", "speedup", "efficiency");
+
+  for (t = 0; t < nthreads; t++) {
+    best = 0;
+    for (run = 0; run < runs; run++) {
+      start = tool_nsec();
+      if (woothee_parse_batch_threads((const char *const *)lines.ua,
+                                      lines.len, lines.size, &out,
+                                      threads[t]) != 0) {
+        return 1;
+      }
+      elapsed = tool_nsec() - start;
+      unique = out.unique;
+      woothee_result_free(&out);
+      if (run == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    if (t == 0) {
+      base = best;
+    }
+
+    /* relative to the first thread count */
+    printf("%7d %10.1f %14.0f %7.2fx %10.1f%%\n",
+           threads[t], best / 1e6, lines.size / (best / 1e9), base / best,
+           base / best * threads[0] / threads[t] * 100);
+  }
+
+  printf("\ndistinct User-Agents: %zu\n", unique);
+
+  return 0;
+}
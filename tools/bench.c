@@ -0,0 +1,140 @@
+/*
+ * woothee-bench: time woothee_parse() over the User-Agents of access logs
+ * with and without the fastpath, and profile the rules that ran.
+ *
+ *   woothee-bench [-r] [-n runs] [file ...]
+ *
+ *   -r  each line is a User-Agent (default: the last quoted field of a
+ *       common/combined log line)
+ *   -n  runs per mode, the fastest is reported (default: 3)
+ *
+ * Every line is parsed on every run, identical User-Agents included, as
+ * a server without a result cache would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "woothee.h"
+#include "common.h"
+
+typedef struct {
+  char **ua;
+  size_t size;
+  size_t capacity;
+} bench_lines_t;
+
+static void
+bench_add(void *data, const char *ua)
+{
+  bench_lines_t *lines = data;
+
+  if (lines->size >= lines->capacity) {
+    lines->capacity = lines->capacity ? lines->capacity * 2 : 4096;
+    lines->ua = tool_realloc(lines->ua, sizeof(char *) * lines->capacity);
+  }
+  lines->ua[lines->size] = strdup(ua);
+  if (!lines->ua[lines->size]) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  lines->size++;
+}
+
+/* the fastest of runs passes over the lines */
+static double
+bench_run(const bench_lines_t *lines, int runs)
+{
+  double best = 0, start, elapsed;
+  size_t i;
+  int run;
+
+  for (run = 0; run < runs; run++) {
+    start = tool_nsec();
+    for (i = 0; i < lines->size; i++) {
+      woothee_delete(woothee_parse(lines->ua[i]));
+    }
+    elapsed = tool_nsec() - start;
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  return best;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-r] [-n runs] [file ...]\n", name);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  int raw = 0, runs = 3, i, mode;
+  bench_lines_t lines;
+  woothee_rule_stat_t *stats;
+  double elapsed[2];
+  size_t n;
+
+  memset(&lines, 0, sizeof(lines));
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      raw = 1;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+      if (runs < 1) {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (tool_load_files(argc - i, argv + i, raw, bench_add, &lines) != 0) {
+    return 1;
+  }
+
+  if (lines.size == 0) {
+    fprintf(stderr, "ERROR: no User-Agent found\n");
+    return 1;
+  }
+
+  printf("lines: %zu\n", lines.size);
+  printf("\n%8s %10s %11s\n", "fastpath", "ms", "usec/parse");
+
+  for (mode = 0; mode < 2; mode++) {
+    woothee_fastpath_enable(mode == 0);
+    elapsed[mode] = bench_run(&lines, runs);
+    printf("%8s %10.1f %11.2f\n", mode == 0 ? "on" : "off",
+           elapsed[mode] / 1e6, elapsed[mode] / 1e3 / lines.size);
+  }
+  printf("\nspeedup: %.2fx\n", elapsed[1] / elapsed[0]);
+
+  /* one profiled pass with the fastpath, the rules that ran */
+  woothee_fastpath_enable(1);
+  stats = tool_alloc(sizeof(woothee_rule_stat_t) * woothee_rule_size());
+  for (n = 0; n < lines.size; n++) {
+    woothee_delete(woothee_parse_profiled(lines.ua[n], stats));
+  }
+
+  printf("\n%-26s %10s %10s %8s %11s\n",
+         "rule", "calls", "hits", "hit%", "usec/call");
+  for (i = 0; i < woothee_rule_size(); i++) {
+    if (stats[i].calls == 0) {
+      continue;
+    }
+    printf("%-26s %10llu %10llu %7.2f%% %11.2f\n", woothee_rule_name(i),
+           stats[i].calls, stats[i].hits,
+           (double)stats[i].hits / stats[i].calls * 100,
+           (double)stats[i].nsec / 1e3 / stats[i].calls);
+  }
+
+  free(stats);
+
+  return 0;
+}
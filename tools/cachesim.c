@@ -0,0 +1,718 @@
+/*
+ * woothee-cachesim: replay the User-Agents of access logs through LRU,
+ * LFU, TinyLFU and ARC caches of woothee results.
+ *
+ *   woothee-cachesim [-r] [-c capacity,...] [file ...]
+ *
+ *   -r  each line is a User-Agent (default: the last quoted field of a
+ *       common/combined log line)
+ *   -c  capacities to simulate (default: 64,256,1024,4096,16384,65536)
+ *
+ * Each distinct User-Agent is parsed once to measure its parse time and
+ * the memory its cached result would take; hit rates are then reported
+ * with the parse time the hits would have saved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "woothee.h"
+#include "common.h"
+
+/* per entry overhead of a cache: hash slot, list links, key pointer */
+#define ENTRY_OVERHEAD (sizeof(void *) * 6)
+/* allocator overhead per malloc'ed block */
+#define MALLOC_OVERHEAD 16
+
+typedef struct {
+  char **ua;           /* distinct User-Agents by id */
+  double *parse_nsec;  /* parse time by id */
+  size_t *entry_bytes; /* cached result size by id */
+  int distinct;
+  int *trace;          /* ids in request order */
+  int requests;
+} sim_trace_t;
+
+typedef struct {
+  const char *name;
+  long hits;
+  double saved_nsec;
+  double bytes;
+} sim_result_t;
+
+/*
+ * Trace loading
+ */
+
+typedef struct {
+  int *slots;
+  int size;
+} sim_intern_t;
+
+static unsigned long
+sim_hash(const char *str)
+{
+  unsigned long h = 5381;
+
+  while (*str) {
+    h = h * 33 + (unsigned char)*str++;
+  }
+  return h;
+}
+
+static void
+sim_intern_grow(sim_intern_t *intern, sim_trace_t *trace)
+{
+  int i, j, size = intern->size ? intern->size * 2 : 1024;
+  int *slots = tool_alloc(sizeof(int) * size);
+
+  for (i = 0; i < size; i++) {
+    slots[i] = -1;
+  }
+  for (i = 0; i < trace->distinct; i++) {
+    j = sim_hash(trace->ua[i]) & (size - 1);
+    while (slots[j] >= 0) {
+      j = (j + 1) & (size - 1);
+    }
+    slots[j] = i;
+  }
+
+  free(intern->slots);
+  intern->slots = slots;
+  intern->size = size;
+}
+
+static int
+sim_intern(sim_intern_t *intern, sim_trace_t *trace, const char *ua)
+{
+  int j;
+
+  if (trace->distinct * 2 >= intern->size) {
+    sim_intern_grow(intern, trace);
+    trace->ua = tool_realloc(trace->ua, sizeof(char *) * intern->size);
+  }
+
+  j = sim_hash(ua) & (intern->size - 1);
+  while (intern->slots[j] >= 0) {
+    if (strcmp(trace->ua[intern->slots[j]], ua) == 0) {
+      return intern->slots[j];
+    }
+    j = (j + 1) & (intern->size - 1);
+  }
+
+  intern->slots[j] = trace->distinct;
+  trace->ua[trace->distinct] = strdup(ua);
+
+  return trace->distinct++;
+}
+
+typedef struct {
+  sim_trace_t *trace;
+  sim_intern_t *intern;
+  int capacity;
+} sim_loader_t;
+
+static void
+sim_add(void *data, const char *ua)
+{
+  sim_loader_t *loader = data;
+  sim_trace_t *trace = loader->trace;
+
+  if (trace->requests >= loader->capacity) {
+    loader->capacity = loader->capacity ? loader->capacity * 2 : 4096;
+    trace->trace = tool_realloc(trace->trace,
+                                sizeof(int) * loader->capacity);
+  }
+  trace->trace[trace->requests++] = sim_intern(loader->intern, trace, ua);
+}
+
+static size_t
+sim_string_bytes(const char *str)
+{
+  return str ? strlen(str) + 1 + MALLOC_OVERHEAD : 0;
+}
+
+/* parse every distinct User-Agent, keeping the fastest of three runs */
+static void
+sim_measure(sim_trace_t *trace)
+{
+  int i, run;
+
+  trace->parse_nsec = tool_alloc(sizeof(double) * trace->distinct);
+  trace->entry_bytes = tool_alloc(sizeof(size_t) * trace->distinct);
+
+  for (i = 0; i < trace->distinct; i++) {
+    woothee_t *result = NULL;
+    double best = 0;
+
+    for (run = 0; run < 3; run++) {
+      double start = tool_nsec(), elapsed;
+
+      woothee_delete(result);
+      result = woothee_parse(trace->ua[i]);
+      elapsed = tool_nsec() - start;
+      if (run == 0 || elapsed < best) {
+        best = elapsed;
+      }
+    }
+    trace->parse_nsec[i] = best;
+
+    trace->entry_bytes[i] = ENTRY_OVERHEAD + sim_string_bytes(trace->ua[i]);
+    if (result) {
+      trace->entry_bytes[i] += sizeof(woothee_t) + MALLOC_OVERHEAD
+        + sim_string_bytes(result->name)
+        + sim_string_bytes(result->category)
+        + sim_string_bytes(result->os)
+        + sim_string_bytes(result->os_version)
+        + sim_string_bytes(result->version)
+        + sim_string_bytes(result->vendor);
+    }
+    woothee_delete(result);
+  }
+}
+
+/*
+ * Intrusive lists over ids, shared by the policies
+ */
+
+typedef struct {
+  int head; /* most recent */
+  int tail; /* least recent */
+  int size;
+} sim_list_t;
+
+typedef struct {
+  int *prev;
+  int *next;
+  unsigned char *where; /* list holding the id, 0 for none */
+  sim_list_t list[5];
+} sim_lists_t;
+
+static void
+sim_lists_init(sim_lists_t *lists, int distinct)
+{
+  int i;
+
+  lists->prev = tool_alloc(sizeof(int) * distinct);
+  lists->next = tool_alloc(sizeof(int) * distinct);
+  lists->where = tool_alloc(distinct);
+  for (i = 0; i < 5; i++) {
+    lists->list[i].head = lists->list[i].tail = -1;
+    lists->list[i].size = 0;
+  }
+}
+
+static void
+sim_lists_free(sim_lists_t *lists)
+{
+  free(lists->prev);
+  free(lists->next);
+  free(lists->where);
+}
+
+static void
+sim_list_remove(sim_lists_t *lists, int id)
+{
+  sim_list_t *list = &lists->list[lists->where[id]];
+
+  if (lists->prev[id] >= 0) {
+    lists->next[lists->prev[id]] = lists->next[id];
+  } else {
+    list->head = lists->next[id];
+  }
+  if (lists->next[id] >= 0) {
+    lists->prev[lists->next[id]] = lists->prev[id];
+  } else {
+    list->tail = lists->prev[id];
+  }
+  list->size--;
+  lists->where[id] = 0;
+}
+
+static void
+sim_list_push(sim_lists_t *lists, int which, int id)
+{
+  sim_list_t *list = &lists->list[which];
+
+  lists->prev[id] = -1;
+  lists->next[id] = list->head;
+  if (list->head >= 0) {
+    lists->prev[list->head] = id;
+  } else {
+    list->tail = id;
+  }
+  list->head = id;
+  list->size++;
+  lists->where[id] = (unsigned char)which;
+}
+
+static void
+sim_list_move(sim_lists_t *lists, int which, int id)
+{
+  sim_list_remove(lists, id);
+  sim_list_push(lists, which, id);
+}
+
+/*
+ * LRU
+ */
+
+static void
+sim_lru(const sim_trace_t *trace, int capacity, sim_result_t *result)
+{
+  sim_lists_t lists;
+  int i, id;
+
+  sim_lists_init(&lists, trace->distinct);
+
+  for (i = 0; i < trace->requests; i++) {
+    id = trace->trace[i];
+    if (lists.where[id]) {
+      sim_list_move(&lists, 1, id);
+      result->hits++;
+      result->saved_nsec += trace->parse_nsec[id];
+      continue;
+    }
+    if (lists.list[1].size >= capacity) {
+      result->bytes -= trace->entry_bytes[lists.list[1].tail];
+      sim_list_remove(&lists, lists.list[1].tail);
+    }
+    sim_list_push(&lists, 1, id);
+    result->bytes += trace->entry_bytes[id];
+  }
+
+  sim_lists_free(&lists);
+}
+
+/*
+ * LFU, counting uses while cached, least recent first on ties
+ */
+
+typedef struct {
+  int *heap;
+  int *pos; /* heap index by id, -1 when not cached */
+  long *freq;
+  long *tick;
+  int size;
+} sim_heap_t;
+
+static int
+sim_heap_less(const sim_heap_t *h, int a, int b)
+{
+  if (h->freq[a] != h->freq[b]) {
+    return h->freq[a] < h->freq[b];
+  }
+  return h->tick[a] < h->tick[b];
+}
+
+static void
+sim_heap_swap(sim_heap_t *h, int i, int j)
+{
+  int id = h->heap[i];
+
+  h->heap[i] = h->heap[j];
+  h->heap[j] = id;
+  h->pos[h->heap[i]] = i;
+  h->pos[h->heap[j]] = j;
+}
+
+static void
+sim_heap_down(sim_heap_t *h, int i)
+{
+  for (;;) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+    if (l < h->size && sim_heap_less(h, h->heap[l], h->heap[min])) {
+      min = l;
+    }
+    if (r < h->size && sim_heap_less(h, h->heap[r], h->heap[min])) {
+      min = r;
+    }
+    if (min == i) {
+      return;
+    }
+    sim_heap_swap(h, i, min);
+    i = min;
+  }
+}
+
+static void
+sim_heap_up(sim_heap_t *h, int i)
+{
+  while (i > 0 && sim_heap_less(h, h->heap[i], h->heap[(i - 1) / 2])) {
+    sim_heap_swap(h, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void
+sim_lfu(const sim_trace_t *trace, int capacity, sim_result_t *result)
+{
+  sim_heap_t h;
+  int i, id;
+
+  h.heap = tool_alloc(sizeof(int) * capacity);
+  h.pos = tool_alloc(sizeof(int) * trace->distinct);
+  h.freq = tool_alloc(sizeof(long) * trace->distinct);
+  h.tick = tool_alloc(sizeof(long) * trace->distinct);
+  h.size = 0;
+  for (i = 0; i < trace->distinct; i++) {
+    h.pos[i] = -1;
+  }
+
+  for (i = 0; i < trace->requests; i++) {
+    id = trace->trace[i];
+    h.tick[id] = i;
+    if (h.pos[id] >= 0) {
+      h.freq[id]++;
+      sim_heap_down(&h, h.pos[id]);
+      result->hits++;
+      result->saved_nsec += trace->parse_nsec[id];
+      continue;
+    }
+    if (h.size >= capacity) {
+      int victim = h.heap[0];
+      result->bytes -= trace->entry_bytes[victim];
+      h.pos[victim] = -1;
+      h.size--;
+      if (h.size > 0) {
+        h.heap[0] = h.heap[h.size];
+        h.pos[h.heap[0]] = 0;
+        sim_heap_down(&h, 0);
+      }
+    }
+    h.freq[id] = 1;
+    h.heap[h.size] = id;
+    h.pos[id] = h.size++;
+    sim_heap_up(&h, h.pos[id]);
+    result->bytes += trace->entry_bytes[id];
+  }
+
+  free(h.heap);
+  free(h.pos);
+  free(h.freq);
+  free(h.tick);
+}
+
+/*
+ * W-TinyLFU: a 1% LRU window in front of an LRU main cache, admitting
+ * window victims only when a count-min sketch has seen them more often
+ * than the main victim. The sketch is halved every 10 x capacity uses.
+ */
+
+#define SKETCH_DEPTH 4
+
+typedef struct {
+  unsigned char *counters;
+  unsigned long mask;
+  long samples;
+  long period;
+} sim_sketch_t;
+
+static unsigned long
+sim_sketch_index(const sim_sketch_t *sketch, int id, int row)
+{
+  unsigned long long h = (unsigned long long)(id + 1)
+    * (0x9e3779b97f4a7c15ULL + 2 * row + 1);
+
+  h ^= h >> 32;
+  return (unsigned long)h & sketch->mask;
+}
+
+static int
+sim_sketch_count(const sim_sketch_t *sketch, int id)
+{
+  int row, min = 15;
+
+  for (row = 0; row < SKETCH_DEPTH; row++) {
+    int c = sketch->counters[row * (sketch->mask + 1)
+                             + sim_sketch_index(sketch, id, row)];
+    if (c < min) {
+      min = c;
+    }
+  }
+  return min;
+}
+
+static void
+sim_sketch_add(sim_sketch_t *sketch, int id)
+{
+  unsigned long i;
+  int row;
+
+  for (row = 0; row < SKETCH_DEPTH; row++) {
+    unsigned char *c = &sketch->counters[row * (sketch->mask + 1)
+                                         + sim_sketch_index(sketch, id, row)];
+    if (*c < 15) {
+      (*c)++;
+    }
+  }
+
+  if (++sketch->samples >= sketch->period) {
+    for (i = 0; i < SKETCH_DEPTH * (sketch->mask + 1); i++) {
+      sketch->counters[i] >>= 1;
+    }
+    sketch->samples /= 2;
+  }
+}
+
+static void
+sim_tinylfu(const sim_trace_t *trace, int capacity, sim_result_t *result)
+{
+  sim_sketch_t sketch;
+  sim_lists_t lists;
+  int window_max, main_max, i, id;
+  unsigned long width = 16;
+
+  window_max = capacity / 100 > 0 ? capacity / 100 : 1;
+  main_max = capacity - window_max;
+
+  while (width < (unsigned long)capacity * 4) {
+    width <<= 1;
+  }
+  sketch.counters = tool_alloc(SKETCH_DEPTH * width);
+  sketch.mask = width - 1;
+  sketch.samples = 0;
+  sketch.period = (long)capacity * 10;
+
+  /* list 1 is the window, list 2 the main cache */
+  sim_lists_init(&lists, trace->distinct);
+
+  for (i = 0; i < trace->requests; i++) {
+    id = trace->trace[i];
+    sim_sketch_add(&sketch, id);
+
+    if (lists.where[id]) {
+      sim_list_move(&lists, lists.where[id], id);
+      result->hits++;
+      result->saved_nsec += trace->parse_nsec[id];
+      continue;
+    }
+
+    sim_list_push(&lists, 1, id);
+    result->bytes += trace->entry_bytes[id];
+    if (lists.list[1].size <= window_max) {
+      continue;
+    }
+
+    id = lists.list[1].tail;
+    sim_list_remove(&lists, id);
+    if (lists.list[2].size < main_max) {
+      sim_list_push(&lists, 2, id);
+      continue;
+    }
+    if (main_max > 0) {
+      int victim = lists.list[2].tail;
+      if (sim_sketch_count(&sketch, id) > sim_sketch_count(&sketch, victim)) {
+        sim_list_remove(&lists, victim);
+        sim_list_push(&lists, 2, id);
+        id = victim;
+      }
+    }
+    result->bytes -= trace->entry_bytes[id];
+  }
+
+  sim_lists_free(&lists);
+  free(sketch.counters);
+}
+
+/*
+ * ARC (Megiddo and Modha), ghost lists B1 and B2 hold ids only
+ */
+
+enum { ARC_T1 = 1, ARC_T2, ARC_B1, ARC_B2 };
+
+static void
+sim_arc_replace(sim_lists_t *lists, const sim_trace_t *trace,
+                sim_result_t *result, int in_b2, double p)
+{
+  int t1 = lists->list[ARC_T1].size, id;
+
+  if (t1 >= 1 && ((in_b2 && t1 == (int)p) || t1 > p
+                  || lists->list[ARC_T2].size == 0)) {
+    id = lists->list[ARC_T1].tail;
+    sim_list_move(lists, ARC_B1, id);
+  } else {
+    id = lists->list[ARC_T2].tail;
+    sim_list_move(lists, ARC_B2, id);
+  }
+  result->bytes -= trace->entry_bytes[id];
+}
+
+static void
+sim_arc(const sim_trace_t *trace, int capacity, sim_result_t *result)
+{
+  sim_lists_t lists;
+  sim_list_t *l;
+  double p = 0, delta;
+  int i, id;
+
+  sim_lists_init(&lists, trace->distinct);
+  l = lists.list;
+
+  for (i = 0; i < trace->requests; i++) {
+    id = trace->trace[i];
+
+    switch (lists.where[id]) {
+    case ARC_T1:
+    case ARC_T2:
+      sim_list_move(&lists, ARC_T2, id);
+      result->hits++;
+      result->saved_nsec += trace->parse_nsec[id];
+      continue;
+    case ARC_B1:
+      delta = l[ARC_B2].size > l[ARC_B1].size
+        ? (double)l[ARC_B2].size / l[ARC_B1].size : 1;
+      p = (p + delta < capacity) ? p + delta : capacity;
+      sim_arc_replace(&lists, trace, result, 0, p);
+      sim_list_move(&lists, ARC_T2, id);
+      result->bytes += trace->entry_bytes[id];
+      continue;
+    case ARC_B2:
+      delta = l[ARC_B1].size > l[ARC_B2].size
+        ? (double)l[ARC_B1].size / l[ARC_B2].size : 1;
+      p = (p - delta > 0) ? p - delta : 0;
+      sim_arc_replace(&lists, trace, result, 1, p);
+      sim_list_move(&lists, ARC_T2, id);
+      result->bytes += trace->entry_bytes[id];
+      continue;
+    }
+
+    if (l[ARC_T1].size + l[ARC_B1].size == capacity) {
+      if (l[ARC_T1].size < capacity) {
+        sim_list_remove(&lists, l[ARC_B1].tail);
+        sim_arc_replace(&lists, trace, result, 0, p);
+      } else {
+        result->bytes -= trace->entry_bytes[l[ARC_T1].tail];
+        sim_list_remove(&lists, l[ARC_T1].tail);
+      }
+    } else {
+      int total = l[ARC_T1].size + l[ARC_T2].size
+        + l[ARC_B1].size + l[ARC_B2].size;
+      if (total >= capacity) {
+        if (total == 2 * capacity) {
+          sim_list_remove(&lists, l[ARC_B2].tail);
+        }
+        sim_arc_replace(&lists, trace, result, 0, p);
+      }
+    }
+    sim_list_push(&lists, ARC_T1, id);
+    result->bytes += trace->entry_bytes[id];
+  }
+
+  sim_lists_free(&lists);
+}
+
+/*
+ * Main
+ */
+
+typedef void (*sim_policy_fn)(const sim_trace_t *trace, int capacity,
+                              sim_result_t *result);
+
+static const struct {
+  const char *name;
+  sim_policy_fn fn;
+} policies[] = {
+  { "LRU", sim_lru },
+  { "LFU", sim_lfu },
+  { "TinyLFU", sim_tinylfu },
+  { "ARC", sim_arc },
+};
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-r] [-c capacity,...] [file ...]\n", prog);
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const int default_capacities[] = {
+    64, 256, 1024, 4096, 16384, 65536
+  };
+  int capacities[64];
+  int ncapacities = 0, raw = 0, i, c, p;
+  sim_intern_t intern = { NULL, 0 };
+  sim_trace_t trace;
+  sim_loader_t loader;
+  double total_nsec = 0, total_bytes = 0;
+
+  memset(&trace, 0, sizeof(trace));
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      raw = 1;
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      char *list = argv[++i], *end;
+      while (*list && ncapacities < 64) {
+        long n = strtol(list, &end, 10);
+        if (end == list || n < 1) {
+          usage(argv[0]);
+        }
+        capacities[ncapacities++] = (int)n;
+        list = (*end == ',') ? end + 1 : end;
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  loader.trace = &trace;
+  loader.intern = &intern;
+  loader.capacity = 0;
+  if (tool_load_files(argc - i, argv + i, raw, sim_add, &loader) != 0) {
+    return 1;
+  }
+
+  if (trace.requests == 0) {
+    fprintf(stderr, "ERROR: no User-Agent found\n");
+    return 1;
+  }
+
+  if (ncapacities == 0) {
+    for (i = 0; i < (int)(sizeof(default_capacities) / sizeof(int)); i++) {
+      capacities[ncapacities++] = default_capacities[i];
+    }
+  }
+
+  sim_measure(&trace);
+
+  for (i = 0; i < trace.requests; i++) {
+    total_nsec += trace.parse_nsec[trace.trace[i]];
+  }
+  for (i = 0; i < trace.distinct; i++) {
+    total_bytes += trace.entry_bytes[i];
+  }
+
+  printf("requests: %d\n", trace.requests);
+  printf("distinct User-Agents: %d\n", trace.distinct);
+  printf("parse time without cache: %.1f ms (%.2f usec/request)\n",
+         total_nsec / 1e6, total_nsec / 1e3 / trace.requests);
+  printf("entry size: %.0f bytes on average\n",
+         total_bytes / trace.distinct);
+  printf("\n%-8s %9s %8s %12s %12s %8s\n",
+         "policy", "capacity", "hit%", "saved ms", "saved %", "memory");
+
+  for (c = 0; c < ncapacities; c++) {
+    for (p = 0; p < (int)(sizeof(policies) / sizeof(policies[0])); p++) {
+      sim_result_t result;
+
+      memset(&result, 0, sizeof(result));
+      result.name = policies[p].name;
+      policies[p].fn(&trace, capacities[c], &result);
+
+      printf("%-8s %9d %7.2f%% %12.1f %11.2f%% %7.0fK\n",
+             result.name, capacities[c],
+             100.0 * result.hits / trace.requests,
+             result.saved_nsec / 1e6,
+             100.0 * result.saved_nsec / total_nsec,
+             result.bytes / 1024);
+    }
+  }
+
+  return 0;
+}
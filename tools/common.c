@@ -0,0 +1,120 @@
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+#define LINE_MAX_SIZE 16384
+
+/* zeroed memory, exiting when there is none */
+void *
+tool_alloc(size_t size)
+{
+  void *ptr = calloc(1, size ? size : 1);
+
+  if (!ptr) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  return ptr;
+}
+
+void *
+tool_realloc(void *ptr, size_t size)
+{
+  ptr = realloc(ptr, size);
+  if (!ptr) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    exit(1);
+  }
+  return ptr;
+}
+
+/* the last double-quoted field of a log line, unescaping \" */
+char *
+tool_log_user_agent(char *line)
+{
+  char *end, *start, *src, *dst;
+
+  end = strrchr(line, '"');
+  if (!end) {
+    return NULL;
+  }
+
+  start = end;
+  while (start > line) {
+    start--;
+    if (*start == '"' && (start == line || start[-1] != '\\')) {
+      break;
+    }
+  }
+  if (start == end || *start != '"') {
+    return NULL;
+  }
+
+  *end = '\0';
+  for (src = dst = start + 1; *src; src++) {
+    if (*src == '\\' && src[1]) {
+      src++;
+    }
+    *dst++ = *src;
+  }
+  *dst = '\0';
+
+  return start + 1;
+}
+
+/*
+ * Pass each User-Agent of fp to fn: the last quoted field of each line
+ * (combined log format), or with raw the whole line. Lines without one
+ * and "-" are skipped.
+ */
+void
+tool_load(FILE *fp, int raw, tool_user_agent_fn fn, void *data)
+{
+  static char line[LINE_MAX_SIZE];
+  char *ua;
+
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    ua = raw ? line : tool_log_user_agent(line);
+    if (!ua || !*ua || strcmp(ua, "-") == 0) {
+      continue;
+    }
+
+    fn(data, ua);
+  }
+}
+
+/* tool_load() of each file, or of stdin when there is none; 1 on error */
+int
+tool_load_files(int argc, char **argv, int raw,
+                tool_user_agent_fn fn, void *data)
+{
+  int i;
+
+  if (argc == 0) {
+    tool_load(stdin, raw, fn, data);
+  }
+  for (i = 0; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "r");
+    if (!fp) {
+      perror(argv[i]);
+      return 1;
+    }
+    tool_load(fp, raw, fn, data);
+    fclose(fp);
+  }
+
+  return 0;
+}
+
+double
+tool_nsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -0,0 +1,25 @@
+#ifndef WOOTHEE_TOOLS_COMMON_H
+#define WOOTHEE_TOOLS_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Helpers shared by the tools: allocation that exits on failure, the
+ * User-Agents of access logs and a monotonic clock.
+ */
+
+/* called with each User-Agent, valid until it returns */
+typedef void (*tool_user_agent_fn)(void *data, const char *ua);
+
+void * tool_alloc(size_t size);
+void * tool_realloc(void *ptr, size_t size);
+
+char * tool_log_user_agent(char *line);
+void tool_load(FILE *fp, int raw, tool_user_agent_fn fn, void *data);
+int tool_load_files(int argc, char **argv, int raw,
+                    tool_user_agent_fn fn, void *data);
+
+double tool_nsec(void);
+
+#endif
@@ -3,25 +3,29 @@
 #include "util.h"
 
 int
-woothee_appliance_challenge_playstation(const char *ua, woothee_t *result)
+woothee_appliance_challenge_playstation(const char *ua, woothee_t *result,
+                                        const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
 
   if (strstr(ua, "PSP (PlayStation Portable);") != NULL) {
     data = woothee_dataset_get(PSP);
-    version = woothee_match_get(
-      "PSP \\(PlayStation Portable\\); ([.0-9]+)\\)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "PSP \\(PlayStation Portable\\); ([.0-9]+)\\)", 0, ua, 1);
   } else if (strstr(ua, "PlayStation Vita") != NULL) {
     data = woothee_dataset_get(PSVita);
-    version = woothee_match_get("PlayStation Vita ([.0-9]+)\\)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "PlayStation Vita ([.0-9]+)\\)", 0, ua, 1);
   } else if (strstr(ua, "PLAYSTATION 3 ") != NULL
              || strstr(ua, "PLAYSTATION 3;") != NULL) {
     data = woothee_dataset_get(PS3);
-    version = woothee_match_get("PLAYSTATION 3;? ([.0-9]+)\\)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "PLAYSTATION 3;? ([.0-9]+)\\)", 0, ua, 1);
   } else if (strstr(ua, "PlayStation 4 ") != NULL) {
     data = woothee_dataset_get(PS4);
-    version = woothee_match_get("PlayStation 4 ([.0-9]+)\\)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "PlayStation 4 ([.0-9]+)\\)", 0, ua, 1);
   }
 
   if (data == NULL) {
@@ -38,7 +42,8 @@ woothee_appliance_challenge_playstation(const char *ua, woothee_t *result)
 }
 
 int
-woothee_appliance_challenge_nintendo(const char *ua, woothee_t *result)
+woothee_appliance_challenge_nintendo(const char *ua, woothee_t *result,
+                                     const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
@@ -62,7 +67,8 @@ woothee_appliance_challenge_nintendo(const char *ua, woothee_t *result)
 }
 
 int
-woothee_appliance_challenge_digitaltv(const char *ua, woothee_t *result)
+woothee_appliance_challenge_digitaltv(const char *ua, woothee_t *result,
+                                      const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
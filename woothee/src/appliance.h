@@ -1,10 +1,13 @@
 #ifndef WOOTHEE_APPLIANCE_H
 #define WOOTHEE_APPLIANCE_H
 
-#include "woothee.h"
+#include "util.h"
 
-int woothee_appliance_challenge_playstation(const char *ua, woothee_t *result);
-int woothee_appliance_challenge_nintendo(const char *ua, woothee_t *result);
-int woothee_appliance_challenge_digitaltv(const char *ua, woothee_t *result);
+int woothee_appliance_challenge_playstation(const char *ua, woothee_t *result,
+                                            const woothee_scope_t *scope);
+int woothee_appliance_challenge_nintendo(const char *ua, woothee_t *result,
+                                         const woothee_scope_t *scope);
+int woothee_appliance_challenge_digitaltv(const char *ua, woothee_t *result,
+                                          const woothee_scope_t *scope);
 
 #endif
@@ -0,0 +1,496 @@
+#include <pthread.h>
+
+#include "woothee.h"
+
+/*
+ * Batch parse for log enrichment. Identical useragents of the batch are
+ * found through an open addressing hash table and parsed once; the
+ * answers are then copied line by line into the result columns.
+ */
+
+#define BATCH_THREADS_MAX 256
+#define BATCH_CHUNK 1024   /* lines a worker takes at a time */
+#define BATCH_STRIPES 64   /* locks of the shared table */
+#define BATCH_ARENA_SIZE 65536
+
+static unsigned int
+batch_hash(const char *ua, size_t len)
+{
+  unsigned int hash = 2166136261U;
+  size_t i;
+
+  /* FNV-1a */
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char)ua[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+void
+woothee_result_free(woothee_result_t *out)
+{
+  size_t i;
+
+  if (!out) {
+    return;
+  }
+
+  if (out->results) {
+    for (i = 0; i < out->unique; i++) {
+      if (out->results[i]) {
+        woothee_delete(out->results[i]);
+      }
+    }
+    free(out->results);
+  }
+  free(out->id);
+  free(out->category);
+  free(out->name);
+  free(out->version_major);
+  free(out->version_minor);
+
+  memset(out, 0, sizeof(woothee_result_t));
+}
+
+int
+woothee_parse_batch(const char *const *uas, const size_t *lens, size_t n,
+                    woothee_result_t *out)
+{
+  unsigned int *table = NULL, *hashes = NULL, hash;
+  size_t *first = NULL, *length = NULL;
+  unsigned char *category = NULL;
+  short *name = NULL;
+  size_t capacity = 16, slot, i, d, len;
+  const char *ua;
+  char *copy;
+  woothee_t *result;
+
+  if (!out) {
+    return -1;
+  }
+  memset(out, 0, sizeof(woothee_result_t));
+  out->size = n;
+
+  while (capacity < n * 2) {
+    capacity <<= 1;
+  }
+
+  table = (unsigned int *)calloc(capacity, sizeof(unsigned int));
+  hashes = (unsigned int *)malloc((n + 1) * sizeof(unsigned int));
+  first = (size_t *)malloc((n + 1) * sizeof(size_t));
+  length = (size_t *)malloc((n + 1) * sizeof(size_t));
+  out->id = (unsigned int *)malloc((n + 1) * sizeof(unsigned int));
+  out->category = (unsigned char *)malloc(n + 1);
+  out->name = (short *)malloc((n + 1) * sizeof(short));
+  out->version_major = (int *)malloc((n + 1) * sizeof(int));
+  out->version_minor = (int *)malloc((n + 1) * sizeof(int));
+  if (!table || !hashes || !first || !length || !out->id || !out->category
+      || !out->name || !out->version_major || !out->version_minor) {
+    goto error;
+  }
+
+  /* distinct useragents, a table slot holds the index + 1 of one */
+  for (i = 0; i < n; i++) {
+    ua = uas[i] ? uas[i] : "";
+    len = lens ? lens[i] : strlen(ua);
+    hash = batch_hash(ua, len);
+
+    for (slot = hash & (capacity - 1); table[slot];
+         slot = (slot + 1) & (capacity - 1)) {
+      d = table[slot] - 1;
+      if (hashes[d] == hash && length[d] == len
+          && memcmp(uas[first[d]], ua, len) == 0) {
+        break;
+      }
+    }
+
+    if (!table[slot]) {
+      d = out->unique++;
+      hashes[d] = hash;
+      first[d] = i;
+      length[d] = len;
+      table[slot] = (unsigned int)(d + 1);
+    }
+    out->id[i] = (unsigned int)d;
+  }
+
+  out->results = (woothee_t **)calloc(out->unique + 1, sizeof(woothee_t *));
+  category = (unsigned char *)malloc(out->unique + 1);
+  name = (short *)malloc((out->unique + 1) * sizeof(short));
+  if (!out->results || !category || !name) {
+    goto error;
+  }
+
+  /* each distinct one parsed once */
+  for (d = 0; d < out->unique; d++) {
+    copy = strndup(uas[first[d]] ? uas[first[d]] : "", length[d]);
+    if (!copy) {
+      goto error;
+    }
+    result = woothee_parse(copy);
+    free(copy);
+
+    out->results[d] = result;
+    if (result) {
+      category[d] = (unsigned char)woothee_category_id(result->category);
+      name[d] = (short)woothee_dataset_index(result->name);
+    } else {
+      category[d] = WOOTHEE_CATEGORY_UNKNOWN;
+      name[d] = -1;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    d = out->id[i];
+    result = out->results[d];
+    out->category[i] = category[d];
+    out->name[i] = name[d];
+    out->version_major[i] = result ? result->version_major : -1;
+    out->version_minor[i] = result ? result->version_minor : -1;
+  }
+
+  free(table);
+  free(hashes);
+  free(first);
+  free(length);
+  free(category);
+  free(name);
+
+  return 0;
+
+error:
+  fprintf(stderr, "ERROR: Cannot allocate memory\n");
+  free(table);
+  free(hashes);
+  free(first);
+  free(length);
+  free(category);
+  free(name);
+  woothee_result_free(out);
+
+  return -1;
+}
+
+/*
+ * Threaded batch parse. The lines are cut in chunks of BATCH_CHUNK and
+ * every worker starts on its own run of chunks; one that runs out takes
+ * the next chunks of the others in turn, so a worker slowed by rare
+ * useragents is helped by the rest.
+ *
+ * The distinct useragents are kept in one chained hash table shared by
+ * the workers, each bucket under one of BATCH_STRIPES locks. The worker
+ * that inserts a useragent parses it, outside the lock; the lines only
+ * note its id and the columns are filled after every worker is done.
+ */
+
+typedef struct batch_entry_s {
+  struct batch_entry_s *next;
+  const char *ua;
+  size_t len;
+  unsigned int hash;
+  unsigned int id;
+} batch_entry_t;
+
+/* worker scratch, released with the batch */
+typedef struct batch_arena_s {
+  struct batch_arena_s *next;
+  size_t used;
+  batch_entry_t entry[BATCH_ARENA_SIZE / sizeof(batch_entry_t)];
+} batch_arena_t;
+
+typedef struct {
+  size_t next; /* next chunk, taken with __atomic_fetch_add */
+  size_t end;
+} batch_queue_t;
+
+typedef struct batch_pool_s batch_pool_t;
+
+typedef struct {
+  batch_pool_t *pool;
+  int index;
+  pthread_t thread;
+  batch_queue_t queue;
+  batch_arena_t *arena;
+  char *scratch; /* the NUL terminated useragent to parse */
+  size_t scratch_size;
+} batch_worker_t;
+
+struct batch_pool_s {
+  const char *const *uas;
+  const size_t *lens;
+  size_t n;
+  woothee_result_t *out;
+  batch_entry_t **buckets;
+  size_t mask;
+  pthread_mutex_t locks[BATCH_STRIPES];
+  unsigned int unique;
+  unsigned char *category; /* by id */
+  short *name;
+  batch_worker_t *workers;
+  int threads;
+  int phase;
+  int failed;
+};
+
+static batch_entry_t *
+batch_entry_alloc(batch_worker_t *worker)
+{
+  batch_arena_t *arena = worker->arena;
+
+  if (!arena || arena->used == sizeof(arena->entry) / sizeof(batch_entry_t)) {
+    arena = (batch_arena_t *)malloc(sizeof(batch_arena_t));
+    if (!arena) {
+      return NULL;
+    }
+    arena->next = worker->arena;
+    arena->used = 0;
+    worker->arena = arena;
+  }
+
+  return &arena->entry[arena->used++];
+}
+
+static woothee_t *
+batch_parse(batch_worker_t *worker, const char *ua, size_t len)
+{
+  char *scratch;
+
+  if (len >= worker->scratch_size) {
+    scratch = (char *)realloc(worker->scratch, len + 256);
+    if (!scratch) {
+      return NULL;
+    }
+    worker->scratch = scratch;
+    worker->scratch_size = len + 256;
+  }
+  memcpy(worker->scratch, ua, len);
+  worker->scratch[len] = '\0';
+
+  return woothee_parse(worker->scratch);
+}
+
+/* the id of the useragent, inserting and parsing it when it is new */
+static int
+batch_intern(batch_worker_t *worker, const char *ua, size_t len)
+{
+  batch_pool_t *pool = worker->pool;
+  unsigned int hash = batch_hash(ua, len);
+  size_t bucket = hash & pool->mask;
+  pthread_mutex_t *lock = &pool->locks[bucket % BATCH_STRIPES];
+  batch_entry_t *entry;
+  woothee_t *result;
+  unsigned int id;
+
+  pthread_mutex_lock(lock);
+  for (entry = pool->buckets[bucket]; entry; entry = entry->next) {
+    if (entry->hash == hash && entry->len == len
+        && memcmp(entry->ua, ua, len) == 0) {
+      pthread_mutex_unlock(lock);
+      return (int)entry->id;
+    }
+  }
+
+  entry = batch_entry_alloc(worker);
+  if (!entry) {
+    pthread_mutex_unlock(lock);
+    return -1;
+  }
+  id = __atomic_fetch_add(&pool->unique, 1, __ATOMIC_RELAXED);
+  entry->ua = ua;
+  entry->len = len;
+  entry->hash = hash;
+  entry->id = id;
+  entry->next = pool->buckets[bucket];
+  pool->buckets[bucket] = entry;
+  pthread_mutex_unlock(lock);
+
+  result = batch_parse(worker, ua, len);
+  pool->out->results[id] = result;
+  if (result) {
+    pool->category[id] = (unsigned char)woothee_category_id(result->category);
+    pool->name[id] = (short)woothee_dataset_index(result->name);
+  } else {
+    pool->category[id] = WOOTHEE_CATEGORY_UNKNOWN;
+    pool->name[id] = -1;
+  }
+
+  return (int)id;
+}
+
+static void
+batch_chunk(batch_worker_t *worker, size_t chunk)
+{
+  batch_pool_t *pool = worker->pool;
+  woothee_result_t *out = pool->out;
+  size_t i, end = (chunk + 1) * BATCH_CHUNK;
+  const char *ua;
+  woothee_t *result;
+  int id;
+
+  if (end > pool->n) {
+    end = pool->n;
+  }
+
+  for (i = chunk * BATCH_CHUNK; i < end; i++) {
+    if (pool->phase == 0) {
+      ua = pool->uas[i] ? pool->uas[i] : "";
+      id = batch_intern(worker, ua, pool->lens ? pool->lens[i] : strlen(ua));
+      if (id < 0) {
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+        return;
+      }
+      out->id[i] = (unsigned int)id;
+    } else {
+      id = (int)out->id[i];
+      result = out->results[id];
+      out->category[i] = pool->category[id];
+      out->name[i] = pool->name[id];
+      out->version_major[i] = result ? result->version_major : -1;
+      out->version_minor[i] = result ? result->version_minor : -1;
+    }
+  }
+}
+
+static void *
+batch_work(void *arg)
+{
+  batch_worker_t *worker = (batch_worker_t *)arg;
+  batch_pool_t *pool = worker->pool;
+  batch_queue_t *queue;
+  size_t chunk;
+  int i;
+
+  /* own chunks first, then the others' */
+  for (i = 0; i < pool->threads; i++) {
+    queue = &pool->workers[(worker->index + i) % pool->threads].queue;
+    for (;;) {
+      chunk = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+      if (chunk >= queue->end
+          || __atomic_load_n(&pool->failed, __ATOMIC_RELAXED)) {
+        break;
+      }
+      batch_chunk(worker, chunk);
+    }
+  }
+
+  return NULL;
+}
+
+static int
+batch_run(batch_pool_t *pool, int phase)
+{
+  size_t chunks = (pool->n + BATCH_CHUNK - 1) / BATCH_CHUNK;
+  int i, started;
+
+  pool->phase = phase;
+  for (i = 0; i < pool->threads; i++) {
+    pool->workers[i].queue.next = chunks * i / pool->threads;
+    pool->workers[i].queue.end = chunks * (i + 1) / pool->threads;
+  }
+
+  for (started = 0; started < pool->threads; started++) {
+    if (pthread_create(&pool->workers[started].thread, NULL, batch_work,
+                       &pool->workers[started]) != 0) {
+      pool->failed = 1;
+      break;
+    }
+  }
+  for (i = 0; i < started; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  return pool->failed ? -1 : 0;
+}
+
+int
+woothee_parse_batch_threads(const char *const *uas, const size_t *lens,
+                            size_t n, woothee_result_t *out, int threads)
+{
+  batch_pool_t pool;
+  batch_arena_t *arena;
+  size_t buckets = 16;
+  int i, rv = -1;
+
+  if (threads <= 1) {
+    return woothee_parse_batch(uas, lens, n, out);
+  }
+  if (!out) {
+    return -1;
+  }
+  if (threads > BATCH_THREADS_MAX) {
+    threads = BATCH_THREADS_MAX;
+  }
+
+  memset(out, 0, sizeof(woothee_result_t));
+  out->size = n;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.uas = uas;
+  pool.lens = lens;
+  pool.n = n;
+  pool.out = out;
+  pool.threads = threads;
+
+  while (buckets < n) {
+    buckets <<= 1;
+  }
+  pool.mask = buckets - 1;
+
+  pool.buckets = (batch_entry_t **)calloc(buckets, sizeof(batch_entry_t *));
+  pool.category = (unsigned char *)malloc(n + 1);
+  pool.name = (short *)malloc((n + 1) * sizeof(short));
+  pool.workers = (batch_worker_t *)calloc(threads, sizeof(batch_worker_t));
+  out->results = (woothee_t **)calloc(n + 1, sizeof(woothee_t *));
+  out->id = (unsigned int *)malloc((n + 1) * sizeof(unsigned int));
+  out->category = (unsigned char *)malloc(n + 1);
+  out->name = (short *)malloc((n + 1) * sizeof(short));
+  out->version_major = (int *)malloc((n + 1) * sizeof(int));
+  out->version_minor = (int *)malloc((n + 1) * sizeof(int));
+  if (!pool.buckets || !pool.category || !pool.name || !pool.workers
+      || !out->results || !out->id || !out->category || !out->name
+      || !out->version_major || !out->version_minor) {
+    goto done;
+  }
+
+  for (i = 0; i < BATCH_STRIPES; i++) {
+    pthread_mutex_init(&pool.locks[i], NULL);
+  }
+  for (i = 0; i < threads; i++) {
+    pool.workers[i].pool = &pool;
+    pool.workers[i].index = i;
+  }
+
+  /* phase 0 interns and parses, phase 1 fills the line columns */
+  if (batch_run(&pool, 0) == 0 && batch_run(&pool, 1) == 0) {
+    rv = 0;
+  }
+  out->unique = pool.unique;
+
+  for (i = 0; i < BATCH_STRIPES; i++) {
+    pthread_mutex_destroy(&pool.locks[i]);
+  }
+
+done:
+  if (pool.workers) {
+    for (i = 0; i < threads; i++) {
+      while ((arena = pool.workers[i].arena) != NULL) {
+        pool.workers[i].arena = arena->next;
+        free(arena);
+      }
+      free(pool.workers[i].scratch);
+    }
+  }
+  free(pool.workers);
+  free(pool.buckets);
+  free(pool.category);
+  free(pool.name);
+
+  if (rv != 0) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    woothee_result_free(out);
+  }
+
+  return rv;
+}
@@ -3,7 +3,8 @@
 #include "util.h"
 
 int
-woothee_browser_challenge_msie(const char *ua, woothee_t *result)
+woothee_browser_challenge_msie(const char *ua, woothee_t *result,
+                               const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -13,14 +14,14 @@ woothee_browser_challenge_msie(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("MSIE ([.0-9]+);", 0, ua, 1);
-  if (version == NULL) {
+  version = woothee_match_version(scope, "MSIE ([.0-9]+);", 0, ua, 1);
+  if (version == NULL && (scope->fields & WOOTHEE_FIELD_VERSION)) {
     if (woothee_match("Trident/([.0-9]+);", 0, ua)) {
-      version = woothee_match_get(" rv:([.0-9]+)", 0, ua, 1);
+      version = woothee_match_version(scope, " rv:([.0-9]+)", 0, ua, 1);
     }
   }
   if (version == NULL) {
-    version = woothee_match_get("IEMobile/([.0-9]+);", 0, ua, 1);
+    version = woothee_match_version(scope, "IEMobile/([.0-9]+);", 0, ua, 1);
   }
 
   woothee_update(result, woothee_dataset_get(MSIE));
@@ -35,7 +36,8 @@ woothee_browser_challenge_msie(const char *ua, woothee_t *result)
 }
 
 int
-woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result)
+woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result,
+                                        const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -44,14 +46,14 @@ woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result)
   }
 
   /* Edge */
-  if ((version = woothee_match_get("Edge/([.0-9]+)", 0, ua, 1))) {
+  if ((version = woothee_product_get(scope, ua, "Edge"))) {
     woothee_update(result, woothee_dataset_get(Edge));
     woothee_update_version(result, version);
     free(version);
     return 1;
   }
 
-  version = woothee_match_get("FxiOS/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_get(scope, ua, "FxiOS");
   if (version) {
     woothee_update(result, woothee_dataset_get(Firefox));
     woothee_update_version(result, version);
@@ -59,9 +61,9 @@ woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result)
     return 1;
   }
 
-  version = woothee_match_get("(?:Chrome|CrMo|CriOS)/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_get(scope, ua, "Chrome|CrMo|CriOS");
   if (version) {
-    char *opera_version = woothee_match_get("OPR/([.0-9]+)", 0, ua, 1);
+    char *opera_version = woothee_product_get(scope, ua, "OPR");
     if (opera_version) {
       woothee_update(result, woothee_dataset_get(Opera));
       woothee_update_version(result, opera_version);
@@ -78,7 +80,7 @@ woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result)
   }
 
   /* Safari */
-  version = woothee_match_get("Version/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_version(scope, ua, "Version");
   woothee_update(result, woothee_dataset_get(Safari));
   if (version) {
     woothee_update_version(result, version);
@@ -91,7 +93,8 @@ woothee_browser_challenge_safari_chrome(const char *ua, woothee_t *result)
 }
 
 int
-woothee_browser_challenge_firefox(const char *ua, woothee_t *result)
+woothee_browser_challenge_firefox(const char *ua, woothee_t *result,
+                                  const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -99,7 +102,7 @@ woothee_browser_challenge_firefox(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("Firefox/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_version(scope, ua, "Firefox");
   woothee_update(result, woothee_dataset_get(Firefox));
   if (version) {
     woothee_update_version(result, version);
@@ -112,7 +115,8 @@ woothee_browser_challenge_firefox(const char *ua, woothee_t *result)
 }
 
 int
-woothee_browser_challenge_opera(const char *ua, woothee_t *result)
+woothee_browser_challenge_opera(const char *ua, woothee_t *result,
+                                const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -120,9 +124,9 @@ woothee_browser_challenge_opera(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("Version/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_version(scope, ua, "Version");
   if (version == NULL) {
-    version = woothee_match_get("Opera[/ ]([.0-9]+)", 0, ua, 1);
+    version = woothee_match_version(scope, "Opera[/ ]([.0-9]+)", 0, ua, 1);
   }
 
   woothee_update(result, woothee_dataset_get(Opera));
@@ -137,7 +141,8 @@ woothee_browser_challenge_opera(const char *ua, woothee_t *result)
 }
 
 int
-woothee_browser_challenge_webview(const char *ua, woothee_t *result)
+woothee_browser_challenge_webview(const char *ua, woothee_t *result,
+                                  const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -149,7 +154,7 @@ woothee_browser_challenge_webview(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("Version/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_version(scope, ua, "Version");
 
   woothee_update(result, woothee_dataset_get(Webview));
   if (version) {
@@ -163,7 +168,8 @@ woothee_browser_challenge_webview(const char *ua, woothee_t *result)
 }
 
 int
-woothee_browser_challenge_sleipnir(const char *ua, woothee_t *result)
+woothee_browser_challenge_sleipnir(const char *ua, woothee_t *result,
+                                   const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *win = NULL;
@@ -172,7 +178,7 @@ woothee_browser_challenge_sleipnir(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("Sleipnir/([.0-9]+)", 0, ua, 1);
+  version = woothee_product_version(scope, ua, "Sleipnir");
 
   woothee_update(result, woothee_dataset_get(Sleipnir));
   if (version) {
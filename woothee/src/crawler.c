@@ -3,7 +3,8 @@
 #include "util.h"
 
 int
-woothee_crawler_challenge_google(const char *ua, woothee_t *result)
+woothee_crawler_challenge_google(const char *ua, woothee_t *result,
+                                 const woothee_scope_t *scope)
 {
   if (strstr(ua, "Google") == NULL) {
     return 0;
@@ -51,7 +52,8 @@ woothee_crawler_challenge_google(const char *ua, woothee_t *result)
 }
 
 int
-woothee_crawler_challenge_crawlers(const char *ua, woothee_t *result)
+woothee_crawler_challenge_crawlers(const char *ua, woothee_t *result,
+                                   const woothee_scope_t *scope)
 {
   if (strstr(ua, "Yahoo") != NULL
       || strstr(ua, "help.yahoo.co.jp/help/jp/") != NULL
@@ -181,7 +183,8 @@ woothee_crawler_challenge_crawlers(const char *ua, woothee_t *result)
 }
 
 int
-woothee_crawler_challenge_maybe_crawler(const char *ua, woothee_t *result)
+woothee_crawler_challenge_maybe_crawler(const char *ua, woothee_t *result,
+                                        const woothee_scope_t *scope)
 {
   if (woothee_match("(bot|crawler|spider)(?:[-_ ./;@()]|$)", 1, ua)) {
     woothee_update(result, woothee_dataset_get(VariousCrawler));
@@ -208,3 +211,309 @@ woothee_crawler_challenge_maybe_crawler(const char *ua, woothee_t *result)
 
   return 0;
 }
+
+/*
+ * The google and crawlers challenges reduced to their literals, for
+ * woothee_crawler_literal(). Keep in step with the challenges above.
+ *
+ * A CRAWLER_HIT literal classifies the useragent alone. The others only
+ * count together: a Yahoo literal with a Y!J literal, Yeti with the naver
+ * robots page and ichiro with the goo crawler page.
+ */
+#define CRAWLER_HIT    0x01
+#define CRAWLER_YAHOO  0x02
+#define CRAWLER_YJ     0x04
+#define CRAWLER_YETI   0x08
+#define CRAWLER_NAVER  0x10
+#define CRAWLER_ICHIRO 0x20
+#define CRAWLER_GOO    0x40
+
+static const struct {
+  const char *literal;
+  unsigned char flags;
+} crawler_literals[] = {
+  { "Googlebot", CRAWLER_HIT },
+  { "compatible; Mediapartners-Google", CRAWLER_HIT },
+  { "Feedfetcher-Google", CRAWLER_HIT },
+  { "AppEngine-Google", CRAWLER_HIT },
+  { "Google Web Preview", CRAWLER_HIT },
+  { "Yahoo", CRAWLER_YAHOO },
+  { "help.yahoo.co.jp/help/jp/", CRAWLER_YAHOO },
+  { "listing.yahoo.co.jp/support/faq/", CRAWLER_YAHOO },
+  { "compatible; Yahoo! Slurp", CRAWLER_HIT },
+  { "YahooFeedSeekerJp", CRAWLER_HIT },
+  { "YahooFeedSeekerBetaJp", CRAWLER_HIT },
+  { "crawler (http://listing.yahoo.co.jp/support/faq/", CRAWLER_HIT },
+  { "crawler (http://help.yahoo.co.jp/help/jp/", CRAWLER_HIT },
+  { "Y!J-BRZ/YATSHA crawler", CRAWLER_YJ },
+  { "Y!J-BRY/YATSH crawler", CRAWLER_YJ },
+  { "Yahoo Pipes", CRAWLER_HIT },
+  { "msnbot", CRAWLER_HIT },
+  { "compatible; bingbot", CRAWLER_HIT },
+  { "compatible; Baiduspider", CRAWLER_HIT },
+  { "Baiduspider+", CRAWLER_HIT },
+  { "Baiduspider-image+", CRAWLER_HIT },
+  { "Yeti", CRAWLER_YETI },
+  { "http://help.naver.com/robots", CRAWLER_NAVER },
+  { "FeedBurner/", CRAWLER_HIT },
+  { "facebookexternalhit", CRAWLER_HIT },
+  { "Twitterbot/", CRAWLER_HIT },
+  { "ichiro", CRAWLER_ICHIRO },
+  { "http://help.goo.ne.jp/door/crawler.html", CRAWLER_GOO },
+  { "compatible; ichiro/mobile goo;", CRAWLER_HIT },
+  { "gooblogsearch/", CRAWLER_HIT },
+  { "Apple-PubSub", CRAWLER_HIT },
+  { "(www.radian6.com/crawler)", CRAWLER_HIT },
+  { "Genieo/", CRAWLER_HIT },
+  { "labs.topsy.com/butterfly/", CRAWLER_HIT },
+  { "rogerbot/1.0 (http://www.seomoz.org/dp/rogerbot", CRAWLER_HIT },
+  { "compatible; AhrefsBot/", CRAWLER_HIT },
+  { "livedoor FeedFetcher", CRAWLER_HIT },
+  { "Fastladder FeedFetcher", CRAWLER_HIT },
+  { "Hatena Antenna", CRAWLER_HIT },
+  { "Hatena Pagetitle Agent", CRAWLER_HIT },
+  { "Hatena Diary RSS", CRAWLER_HIT },
+  { "mixi-check", CRAWLER_HIT },
+  { "mixi-crawler", CRAWLER_HIT },
+  { "mixi-news-crawler", CRAWLER_HIT },
+  { "compatible; Indy Library", CRAWLER_HIT },
+  { NULL, 0 }
+};
+
+/*
+ * Aho-Corasick automaton of crawler_literals as a full DFA over the bytes
+ * used by the literals (class 0 is any other byte). Built once, on first
+ * use, and read only afterwards.
+ */
+#define CRAWLER_AC_STATES  768
+#define CRAWLER_AC_CLASSES 64
+
+static unsigned short crawler_ac_next[CRAWLER_AC_STATES][CRAWLER_AC_CLASSES];
+static unsigned char crawler_ac_flags[CRAWLER_AC_STATES];
+static unsigned char crawler_ac_class[256];
+static int crawler_ac_state = 0; /* 0: not built, 1: building, 2: ready */
+
+static int
+crawler_ac_build(void)
+{
+  unsigned short fail[CRAWLER_AC_STATES];
+  unsigned short queue[CRAWLER_AC_STATES];
+  int i, c, s, t, head = 0, tail = 0, states = 1, classes = 1;
+  const unsigned char *p;
+
+  for (i = 0; crawler_literals[i].literal; i++) {
+    s = 0;
+    for (p = (const unsigned char *)crawler_literals[i].literal; *p; p++) {
+      if (!crawler_ac_class[*p]) {
+        if (classes >= CRAWLER_AC_CLASSES) {
+          return 0;
+        }
+        crawler_ac_class[*p] = classes++;
+      }
+      c = crawler_ac_class[*p];
+      if (!crawler_ac_next[s][c]) {
+        if (states >= CRAWLER_AC_STATES) {
+          return 0;
+        }
+        crawler_ac_next[s][c] = states++;
+      }
+      s = crawler_ac_next[s][c];
+    }
+    crawler_ac_flags[s] |= crawler_literals[i].flags;
+  }
+
+  for (c = 0; c < classes; c++) {
+    if ((s = crawler_ac_next[0][c])) {
+      fail[s] = 0;
+      queue[tail++] = s;
+    }
+  }
+
+  while (head < tail) {
+    s = queue[head++];
+    crawler_ac_flags[s] |= crawler_ac_flags[fail[s]];
+    for (c = 0; c < classes; c++) {
+      if ((t = crawler_ac_next[s][c])) {
+        fail[t] = crawler_ac_next[fail[s]][c];
+        queue[tail++] = t;
+      } else {
+        crawler_ac_next[s][c] = crawler_ac_next[fail[s]][c];
+      }
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Whether the google or crawlers challenge would classify ua, in one pass
+ * without allocation or regular expressions. Returns -1 while the
+ * automaton is not ready (being built by another thread, or no atomics),
+ * the caller then runs the challenges.
+ */
+int
+woothee_crawler_literal(const char *ua)
+{
+  const unsigned char *p;
+  unsigned int s = 0, flags = 0;
+
+#ifdef __ATOMIC_ACQUIRE
+  if (__atomic_load_n(&crawler_ac_state, __ATOMIC_ACQUIRE) != 2) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&crawler_ac_state, &expected, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+        || !crawler_ac_build()) {
+      return -1;
+    }
+    __atomic_store_n(&crawler_ac_state, 2, __ATOMIC_RELEASE);
+  }
+#else
+  return -1;
+#endif
+
+  if (strncmp(ua, "Mediapartners-Google", 20) == 0) {
+    return 1;
+  }
+
+  for (p = (const unsigned char *)ua; *p; p++) {
+    s = crawler_ac_next[s][crawler_ac_class[*p]];
+    flags |= crawler_ac_flags[s];
+    if (flags & CRAWLER_HIT) {
+      return 1;
+    }
+  }
+
+  return ((flags & CRAWLER_YAHOO) && (flags & CRAWLER_YJ))
+    || ((flags & CRAWLER_YETI) && (flags & CRAWLER_NAVER))
+    || ((flags & CRAWLER_ICHIRO) && (flags & CRAWLER_GOO));
+}
+
+
+/* length of the lower case ASCII literal when at p in any case, else 0 */
+static size_t
+crawler_icase(const char *p, const char *lower)
+{
+  size_t n;
+
+  for (n = 0; lower[n]; n++) {
+    char c = p[n];
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+    if (c != lower[n]) {
+      return 0;
+    }
+  }
+  return n;
+}
+
+/* 1 when p starts a token of ua: at its start or after a non alphanumeric */
+static int
+crawler_token_start(const char *ua, const char *p)
+{
+  char c;
+
+  if (p == ua) {
+    return 1;
+  }
+  c = p[-1];
+
+  return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+           || (c >= '0' && c <= '9'));
+}
+
+/*
+ * Whether the maybe_crawler challenge would classify ua, without its
+ * regular expressions. Keep in step with the challenge above.
+ *
+ * The challenge is a last fallback and matches a word at the end of a
+ * longer one as well ("FooSpider/1.0", but also the "CUBOT X19" phone).
+ * Those matches give WOOTHEE_CRAWLER_MAYBE_INSIDE, matches at a token
+ * start WOOTHEE_CRAWLER_MAYBE_TOKEN, and no match 0.
+ */
+int
+woothee_crawler_maybe_literal(const char *ua)
+{
+  const char *p;
+  size_t n;
+  int inside = 0;
+
+  if (strstr(ua, "ASP-Ranker Feed Crawler") != NULL) {
+    return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+  }
+
+  for (p = ua; *p; p++) {
+    switch (*p) {
+      case 'R':
+        if (strncmp(p, "Rome Client ", 12) == 0) {
+          return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+        }
+        break;
+      case 'U':
+        if (strncmp(p, "UnwindFetchor/", 14) == 0) {
+          return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+        }
+        break;
+      case 'i':
+        if (strncmp(p, "ia_archiver ", 12) == 0) {
+          return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+        }
+        break;
+      case 'S':
+        if (strncmp(p, "Summify ", 8) == 0) {
+          return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+        }
+        break;
+      case 'P':
+        if (strncmp(p, "PostRank/", 9) == 0) {
+          return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+        }
+        break;
+    }
+
+    switch (*p | 0x20) {
+      case 'b':
+        n = crawler_icase(p, "bot");
+        break;
+      case 'c':
+        n = crawler_icase(p, "crawler");
+        break;
+      case 's':
+        n = crawler_icase(p, "spider");
+        break;
+      case 'f':
+      case 'w':
+        /* (feed|web) ?parser, watch ?dog */
+        if ((n = crawler_icase(p, "feed")) || (n = crawler_icase(p, "web"))) {
+          if (p[n] == ' ') {
+            n++;
+          }
+          n = crawler_icase(p + n, "parser");
+        } else if ((n = crawler_icase(p, "watch"))) {
+          if (p[n] == ' ') {
+            n++;
+          }
+          n = crawler_icase(p + n, "dog");
+        }
+        if (n) {
+          if (crawler_token_start(ua, p)) {
+            return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+          }
+          inside = 1;
+        }
+        continue;
+      default:
+        continue;
+    }
+
+    /* [-_ ./;@()] or the end of ua, which strchr() finds as well */
+    if (n && strchr("-_ ./;@()", p[n]) != NULL) {
+      if (crawler_token_start(ua, p)) {
+        return WOOTHEE_CRAWLER_MAYBE_TOKEN;
+      }
+      inside = 1;
+    }
+  }
+
+  return inside ? WOOTHEE_CRAWLER_MAYBE_INSIDE : 0;
+}
@@ -1,10 +1,20 @@
 #ifndef WOOTHEE_CRAWLER_H
 #define WOOTHEE_CRAWLER_H
 
-#include "woothee.h"
+#include "util.h"
 
-int woothee_crawler_challenge_google(const char *ua, woothee_t *result);
-int woothee_crawler_challenge_crawlers(const char *ua, woothee_t *result);
-int woothee_crawler_challenge_maybe_crawler(const char *ua, woothee_t *result);
+int woothee_crawler_challenge_google(const char *ua, woothee_t *result,
+                                     const woothee_scope_t *scope);
+int woothee_crawler_challenge_crawlers(const char *ua, woothee_t *result,
+                                       const woothee_scope_t *scope);
+int woothee_crawler_challenge_maybe_crawler(const char *ua, woothee_t *result,
+                                            const woothee_scope_t *scope);
+
+int woothee_crawler_literal(const char *ua);
+/* woothee_crawler_maybe_literal() matches */
+#define WOOTHEE_CRAWLER_MAYBE_TOKEN  1
+#define WOOTHEE_CRAWLER_MAYBE_INSIDE 2
+
+int woothee_crawler_maybe_literal(const char *ua);
 
 #endif
@@ -196,4 +196,7 @@ static woothee_dataset_t dataset = {
 
 #define woothee_dataset_get(name) &dataset.name
 
+#define WOOTHEE_DATASET_SIZE \
+  ((int)(sizeof(woothee_dataset_t) / sizeof(woothee_data_t)))
+
 #endif
@@ -0,0 +1,318 @@
+#include "fastpath.h"
+#include "dataset.h"
+#include "util.h"
+
+/*
+ * Recognizer for the Mozilla/5.0 shapes that make up most browser
+ * traffic, in one pass and without regex:
+ *
+ *   Mozilla/5.0 (PLATFORM) AppleWebKit/N (KHTML, like Gecko) PRODUCT
+ *   Mozilla/5.0 (PLATFORM; rv:N) Gecko/N Firefox/V
+ *
+ *   PLATFORM: Windows NT V[; Win64; x64|; WOW64]
+ *             Macintosh; Intel Mac OS X 10_V[_V]
+ *             X11; [Ubuntu; ]Linux x86_64
+ *             Linux; Android V; K
+ *             iPhone; CPU iPhone OS V_V[_V] like Mac OS X
+ *             iPad; CPU OS V_V[_V] like Mac OS X
+ *   PRODUCT:  Chrome/V [Mobile ]Safari/N[ Edg/N| Edge/V]
+ *             Version/V [Mobile/ID ]Safari/N
+ *
+ * Nothing else is accepted up to the end of the useragent, so no literal
+ * of the crawler challenges can occur and the browser and os challenges
+ * are known to give the result set here. On any other byte it returns 0
+ * without touching the result and the useragent goes through them.
+ */
+
+#define FASTPATH_VERSION_SIZE 32
+
+static int
+skip(const char **p, const char *literal, size_t len)
+{
+  if (strncmp(*p, literal, len) != 0) {
+    return 0;
+  }
+  *p += len;
+  return 1;
+}
+
+#define SKIP(p, literal) skip(&(p), literal, sizeof(literal) - 1)
+
+static size_t
+span_digits(const char *p)
+{
+  size_t n = 0;
+
+  while (p[n] >= '0' && p[n] <= '9') {
+    n++;
+  }
+  return n;
+}
+
+/* the [.0-9]+ of the challenges' version regexes, led by a digit */
+static size_t
+span_version(const char *p)
+{
+  size_t n = 0;
+
+  if (p[0] < '0' || p[0] > '9') {
+    return 0;
+  }
+  while ((p[n] >= '0' && p[n] <= '9') || p[n] == '.') {
+    n++;
+  }
+  return n;
+}
+
+/* Mobile/15E148 build ids, upper case so no crawler literal fits in */
+static size_t
+span_build(const char *p)
+{
+  size_t n = 0;
+
+  while ((p[n] >= '0' && p[n] <= '9') || (p[n] >= 'A' && p[n] <= 'Z')) {
+    n++;
+  }
+  return n;
+}
+
+/* D+SEP D+[SEP D+], the os version of the osx and linux challenges */
+static size_t
+span_os_version(const char *p, char sep)
+{
+  size_t n, m;
+
+  n = span_digits(p);
+  if (n == 0 || p[n] != sep || (m = span_digits(p + n + 1)) == 0) {
+    return 0;
+  }
+  n += 1 + m;
+  if (p[n] == sep && (m = span_digits(p + n + 1)) > 0) {
+    n += 1 + m;
+  }
+  return n;
+}
+
+/* as woothee_os_challenge_windows() maps its version */
+static woothee_data_t *
+windows_data(const char *version)
+{
+  if (strncmp(version, "NT 10.0", 7) == 0) {
+    return woothee_dataset_get(Win10);
+  } else if (strncmp(version, "NT 6.3", 6) == 0) {
+    return woothee_dataset_get(Win8_1);
+  } else if (strncmp(version, "NT 6.2", 6) == 0) {
+    return woothee_dataset_get(Win8);
+  } else if (strncmp(version, "NT 6.1", 6) == 0) {
+    return woothee_dataset_get(Win7);
+  } else if (strncmp(version, "NT 6.0", 6) == 0) {
+    return woothee_dataset_get(WinVista);
+  } else if (strncmp(version, "NT 5.1", 6) == 0) {
+    return woothee_dataset_get(WinXP);
+  }
+  return NULL;
+}
+
+static int
+copy_version(char *buf, const char *version, size_t len)
+{
+  if (len >= FASTPATH_VERSION_SIZE) {
+    return 0;
+  }
+  memcpy(buf, version, len);
+  buf[len] = '\0';
+  return 1;
+}
+
+int
+woothee_fastpath(const char *ua, woothee_t *result,
+                 const woothee_scope_t *scope)
+{
+  const char *p = ua;
+  const char *version, *os_version = NULL;
+  size_t n, version_len, os_version_len = 0;
+  woothee_data_t *browser, *os;
+  char version_buf[FASTPATH_VERSION_SIZE];
+  char os_version_buf[FASTPATH_VERSION_SIZE];
+  int os_version_always = 0;
+
+  if (!SKIP(p, "Mozilla/5.0 (")) {
+    return 0;
+  }
+
+  if (SKIP(p, "Windows NT ")) {
+    /* "NT 10.0", up to the [;)] ending the Windows version regex */
+    os_version = p - 3;
+    n = span_version(p);
+    if (n == 0 || (p[n] != ';' && p[n] != ')')) {
+      return 0;
+    }
+    os_version_len = n + 3;
+    os_version_always = 1;
+    if ((os = windows_data(os_version)) == NULL) {
+      return 0;
+    }
+    p += n;
+    if (!SKIP(p, "; Win64; x64")) {
+      SKIP(p, "; WOW64");
+    }
+  } else if (SKIP(p, "Macintosh; Intel Mac OS X ")) {
+    if (p[0] != '1' || p[1] != '0' || (p[2] != '_' && p[2] != '.')) {
+      return 0;
+    }
+    os_version = p;
+    if ((n = span_os_version(p, '_')) == 0
+        && (n = span_os_version(p, '.')) == 0) {
+      return 0;
+    }
+    if (p[n] != ')' && p[n] != ';') {
+      return 0;
+    }
+    os_version_len = n;
+    os = woothee_dataset_get(OSX);
+    p += n;
+  } else if (SKIP(p, "X11; Linux x86_64")
+             || SKIP(p, "X11; Ubuntu; Linux x86_64")) {
+    os = woothee_dataset_get(Linux);
+  } else if (SKIP(p, "Linux; Android ")) {
+    n = span_digits(p);
+    if (n == 0) {
+      return 0;
+    }
+    if (p[n] == '.') {
+      /* Android 4.4[.2], bare majors are left to UNKNOWN */
+      os_version = p;
+      if ((n = span_os_version(p, '.')) == 0) {
+        return 0;
+      }
+      os_version_len = n;
+    }
+    os = woothee_dataset_get(Android);
+    p += n;
+    if (!SKIP(p, "; K")) {
+      return 0;
+    }
+  } else if ((os = SKIP(p, "iPhone; CPU iPhone OS ")
+                    ? woothee_dataset_get(iPhone)
+                    : SKIP(p, "iPad; CPU OS ")
+                    ? woothee_dataset_get(iPad) : NULL)) {
+    os_version = p;
+    if ((n = span_os_version(p, '_')) == 0) {
+      return 0;
+    }
+    os_version_len = n;
+    p += n;
+    if (!SKIP(p, " like Mac OS X")) {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  if (SKIP(p, "; rv:")) {
+    if ((n = span_version(p)) == 0) {
+      return 0;
+    }
+    p += n;
+    if (!SKIP(p, ") Gecko/") || (n = span_version(p)) == 0) {
+      return 0;
+    }
+    p += n;
+    if (!SKIP(p, " Firefox/")) {
+      return 0;
+    }
+    version = p;
+    version_len = span_version(p);
+    p += version_len;
+    browser = woothee_dataset_get(Firefox);
+  } else {
+    if (!SKIP(p, ") AppleWebKit/") || (n = span_version(p)) == 0) {
+      return 0;
+    }
+    p += n;
+    if (!SKIP(p, " (KHTML, like Gecko) ")) {
+      return 0;
+    }
+    if (SKIP(p, "Chrome/")) {
+      version = p;
+      version_len = span_version(p);
+      p += version_len;
+      if (!SKIP(p, " Safari/") && !SKIP(p, " Mobile Safari/")) {
+        return 0;
+      }
+      if ((n = span_version(p)) == 0) {
+        return 0;
+      }
+      p += n;
+      browser = woothee_dataset_get(Chrome);
+      if (SKIP(p, " Edge/")) {
+        version = p;
+        version_len = span_version(p);
+        p += version_len;
+        browser = woothee_dataset_get(Edge);
+      } else if (SKIP(p, " Edg/")) {
+        /* Chromium Edge, which the challenges report as Chrome */
+        if ((n = span_version(p)) == 0) {
+          return 0;
+        }
+        p += n;
+      }
+    } else if (SKIP(p, "Version/")) {
+      version = p;
+      version_len = span_version(p);
+      p += version_len;
+      if (version_len == 0 || !SKIP(p, " ")) {
+        return 0;
+      }
+      if (SKIP(p, "Mobile/")) {
+        if ((n = span_build(p)) == 0) {
+          return 0;
+        }
+        p += n;
+        if (!SKIP(p, " ")) {
+          return 0;
+        }
+      }
+      if (!SKIP(p, "Safari/") || (n = span_version(p)) == 0) {
+        return 0;
+      }
+      p += n;
+      browser = woothee_dataset_get(Safari);
+    } else {
+      return 0;
+    }
+  }
+
+  if (*p != '\0' || version_len == 0
+      || !copy_version(version_buf, version, version_len)
+      || (os_version
+          && !copy_version(os_version_buf, os_version, os_version_len))) {
+    return 0;
+  }
+
+  /* browser challenge */
+  woothee_update(result, browser);
+  if (browser == woothee_dataset_get(Chrome)
+      || browser == woothee_dataset_get(Edge)
+      || (scope->fields & WOOTHEE_FIELD_VERSION)) {
+    woothee_update_version(result, version_buf);
+  } else {
+    woothee_update_version(result, WOOTHEE_DATASET_VALUE_UNKNOWN);
+  }
+
+  /* os challenge */
+  woothee_update_category(result, os->category);
+  woothee_update_os(result, os->name);
+  if (os_version
+      && (os_version_always
+          || (scope->fields & WOOTHEE_FIELD_OS_VERSION))) {
+    for (n = 0; n < os_version_len; n++) {
+      if (os_version_buf[n] == '_') {
+        os_version_buf[n] = '.';
+      }
+    }
+    woothee_update_os_version(result, os_version_buf);
+  }
+
+  return 1;
+}
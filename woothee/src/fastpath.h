@@ -0,0 +1,9 @@
+#ifndef WOOTHEE_FASTPATH_H
+#define WOOTHEE_FASTPATH_H
+
+#include "util.h"
+
+int woothee_fastpath(const char *ua, woothee_t *result,
+                     const woothee_scope_t *scope);
+
+#endif
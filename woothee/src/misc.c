@@ -3,7 +3,8 @@
 #include "util.h"
 
 int
-woothee_misc_challenge_desktoptools(const char *ua, woothee_t *result)
+woothee_misc_challenge_desktoptools(const char *ua, woothee_t *result,
+                                    const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
@@ -25,7 +26,8 @@ woothee_misc_challenge_desktoptools(const char *ua, woothee_t *result)
 }
 
 int
-woothee_misc_challenge_smartphone_patterns(const char *ua, woothee_t *result)
+woothee_misc_challenge_smartphone_patterns(const char *ua, woothee_t *result,
+                                           const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
@@ -39,37 +41,123 @@ woothee_misc_challenge_smartphone_patterns(const char *ua, woothee_t *result)
   return 0;
 }
 
+/* where a regular expression $ matches: the end or a final newline */
+static int
+at_end(const char *p)
+{
+  return *p == '\0' || (*p == '\n' && p[1] == '\0');
+}
+
+#define HAS_PREFIX(ua, prefix) (strncmp(ua, prefix, sizeof(prefix) - 1) == 0)
+
+/*
+ * The language of the product token an http library useragent starts
+ * with, dispatched on its first byte:
+ *   ^(?:Apache-HttpClient/|Jakarta Commons-HttpClient/|Java/)
+ *   ^Wget
+ *   ^(?:libwww-perl|WWW-Mechanize|LWP::Simple|LWP |lwp-trivial)
+ *   ^(?:Ruby|feedzirra|Typhoeus)
+ *   ^(Python-urllib/|Twisted )
+ *   ^(?:PHP|WordPress|CakePHP|PukiWiki|PECL::HTTP)(?:/| |$)
+ */
+static const char *
+http_library_token(const char *ua)
+{
+  const char *p = NULL;
+
+  switch (ua[0]) {
+    case 'A':
+      return HAS_PREFIX(ua, "Apache-HttpClient/") ? "Java" : NULL;
+    case 'J':
+      return HAS_PREFIX(ua, "Jakarta Commons-HttpClient/")
+        || HAS_PREFIX(ua, "Java/") ? "Java" : NULL;
+    case 'W':
+      if (HAS_PREFIX(ua, "Wget")) {
+        return "wget";
+      } else if (HAS_PREFIX(ua, "WWW-Mechanize")) {
+        return "perl";
+      } else if (HAS_PREFIX(ua, "WordPress")) {
+        p = ua + 9;
+      }
+      break;
+    case 'l':
+      return HAS_PREFIX(ua, "libwww-perl")
+        || HAS_PREFIX(ua, "lwp-trivial") ? "perl" : NULL;
+    case 'L':
+      return HAS_PREFIX(ua, "LWP::Simple")
+        || HAS_PREFIX(ua, "LWP ") ? "perl" : NULL;
+    case 'R':
+      return HAS_PREFIX(ua, "Ruby") ? "ruby" : NULL;
+    case 'f':
+      return HAS_PREFIX(ua, "feedzirra") ? "ruby" : NULL;
+    case 'T':
+      if (HAS_PREFIX(ua, "Typhoeus")) {
+        return "ruby";
+      }
+      return HAS_PREFIX(ua, "Twisted ") ? "python" : NULL;
+    case 'P':
+      if (HAS_PREFIX(ua, "Python-urllib/")) {
+        return "python";
+      } else if (HAS_PREFIX(ua, "PHP")) {
+        p = ua + 3;
+      } else if (HAS_PREFIX(ua, "PukiWiki")) {
+        p = ua + 8;
+      } else if (HAS_PREFIX(ua, "PECL::HTTP")) {
+        p = ua + 10;
+      }
+      break;
+    case 'C':
+      if (HAS_PREFIX(ua, "CakePHP")) {
+        p = ua + 7;
+      }
+      break;
+  }
+
+  if (p && (*p == '/' || *p == ' ' || at_end(p))) {
+    return "php";
+  }
+  return NULL;
+}
+
+/* [- ]HttpClient(/|$) */
+static int
+http_library_httpclient(const char *ua)
+{
+  const char *p = ua;
+
+  while ((p = strstr(p, "HttpClient")) != NULL) {
+    if (p > ua && (p[-1] == '-' || p[-1] == ' ')
+        && (p[10] == '/' || at_end(p + 10))) {
+      return 1;
+    }
+    p++;
+  }
+  return 0;
+}
+
 int
-woothee_misc_challenge_http_library(const char *ua, woothee_t *result)
+woothee_misc_challenge_http_library(const char *ua, woothee_t *result,
+                                    const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
+  const char *token;
   char *version = NULL;
 
-  if (woothee_match(
-        "^(?:Apache-HttpClient/|Jakarta Commons-HttpClient/|Java/)", 0, ua)
-      || woothee_match("[- ]HttpClient(/|$)", 0, ua)) {
+  token = http_library_token(ua);
+
+  if ((token && strcmp(token, "Java") == 0)
+      || http_library_httpclient(ua)) {
     data = woothee_dataset_get(HTTPLibrary);
     version = "Java";
   } else if (strstr(ua, "Java(TM) 2 Runtime Environment,") != NULL) {
     data = woothee_dataset_get(HTTPLibrary);
     version = "Java";
-  } else if (woothee_match("^Wget", 0, ua)) {
-    data = woothee_dataset_get(HTTPLibrary);
-    version = "wget";
-  } else if (woothee_match(
-               "^(?:libwww-perl|WWW-Mechanize|LWP::Simple|LWP |lwp-trivial)",
-               0, ua)) {
-    data = woothee_dataset_get(HTTPLibrary);
-    version = "perl";
-  } else if (woothee_match("^(?:Ruby|feedzirra|Typhoeus)", 0, ua)) {
-    data = woothee_dataset_get(HTTPLibrary);
-    version = "ruby";
-  } else if (woothee_match("^(Python-urllib/|Twisted )", 0, ua)) {
+  } else if (token && strcmp(token, "php") != 0) {
     data = woothee_dataset_get(HTTPLibrary);
-    version = "python";
-  } else if (woothee_match(
-               "^(?:PHP|WordPress|CakePHP|PukiWiki|PECL::HTTP)(?:/| |$)", 0, ua)
-             || woothee_match("(?:PEAR |)HTTP_Request(?: class|2)", 0, ua)) {
+    version = (char *)token;
+  } else if (token
+             || strstr(ua, "HTTP_Request class") != NULL
+             || strstr(ua, "HTTP_Request2") != NULL) {
     data = woothee_dataset_get(HTTPLibrary);
     version = "php";
   }
@@ -85,7 +173,8 @@ woothee_misc_challenge_http_library(const char *ua, woothee_t *result)
 }
 
 int
-woothee_misc_challenge_maybe_rss_reader(const char *ua, woothee_t *result)
+woothee_misc_challenge_maybe_rss_reader(const char *ua, woothee_t *result,
+                                        const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
@@ -3,7 +3,8 @@
 #include "util.h"
 
 int
-woothee_mobilephone_challenge_docomo(const char *ua, woothee_t *result)
+woothee_mobilephone_challenge_docomo(const char *ua, woothee_t *result,
+                                     const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -11,9 +12,10 @@ woothee_mobilephone_challenge_docomo(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("DoCoMo/[.0-9]+[ /]([^- /;()\"']+)", 0, ua, 1);
+  version = woothee_match_version(
+    scope, "DoCoMo/[.0-9]+[ /]([^- /;()\"']+)", 0, ua, 1);
   if (version == NULL) {
-    version = woothee_match_get("\\(([^;)]+);FOMA;", 0, ua, 1);
+    version = woothee_match_version(scope, "\\(([^;)]+);FOMA;", 0, ua, 1);
   }
 
   woothee_update(result, woothee_dataset_get(docomo));
@@ -28,7 +30,8 @@ woothee_mobilephone_challenge_docomo(const char *ua, woothee_t *result)
 }
 
 int
-woothee_mobilephone_challenge_au(const char *ua, woothee_t *result)
+woothee_mobilephone_challenge_au(const char *ua, woothee_t *result,
+                                 const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -36,7 +39,7 @@ woothee_mobilephone_challenge_au(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("KDDI-([^- /;()\"']+)", 0, ua, 1);
+  version = woothee_match_version(scope, "KDDI-([^- /;()\"']+)", 0, ua, 1);
 
   woothee_update(result, woothee_dataset_get(au));
   if (version) {
@@ -50,7 +53,8 @@ woothee_mobilephone_challenge_au(const char *ua, woothee_t *result)
 }
 
 int
-woothee_mobilephone_challenge_softbank(const char *ua, woothee_t *result)
+woothee_mobilephone_challenge_softbank(const char *ua, woothee_t *result,
+                                       const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -59,8 +63,8 @@ woothee_mobilephone_challenge_softbank(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get(
-    "(?:SoftBank|Vodafone|J-PHONE)/[.0-9]+/([^ /;()]+)", 0, ua, 1);
+  version = woothee_match_version(
+    scope, "(?:SoftBank|Vodafone|J-PHONE)/[.0-9]+/([^ /;()]+)", 0, ua, 1);
 
   woothee_update(result, woothee_dataset_get(SoftBank));
   if (version) {
@@ -74,7 +78,8 @@ woothee_mobilephone_challenge_softbank(const char *ua, woothee_t *result)
 }
 
 int
-woothee_mobilephone_challenge_willcom(const char *ua, woothee_t *result)
+woothee_mobilephone_challenge_willcom(const char *ua, woothee_t *result,
+                                      const woothee_scope_t *scope)
 {
   char *version = NULL;
 
@@ -82,7 +87,8 @@ woothee_mobilephone_challenge_willcom(const char *ua, woothee_t *result)
     return 0;
   }
 
-  version = woothee_match_get("(?:WILLCOM|DDIPOCKET);[^/]+/([^ /;()]+)", 0, ua, 1);
+  version = woothee_match_version(
+    scope, "(?:WILLCOM|DDIPOCKET);[^/]+/([^ /;()]+)", 0, ua, 1);
 
   woothee_update(result, woothee_dataset_get(willcom));
   if (version) {
@@ -96,13 +102,15 @@ woothee_mobilephone_challenge_willcom(const char *ua, woothee_t *result)
 }
 
 int
-woothee_mobilephone_challenge_misc(const char *ua, woothee_t *result)
+woothee_mobilephone_challenge_misc(const char *ua, woothee_t *result,
+                                   const woothee_scope_t *scope)
 {
   char *version = NULL;
 
   if (strstr(ua, "jig browser") != NULL) {
     woothee_update(result, woothee_dataset_get(jig));
-    version = woothee_match_get("jig browser[^;]+; ([^);]+)", 0, ua, 1);
+    version = woothee_match_version(
+      scope, "jig browser[^;]+; ([^);]+)", 0, ua, 1);
     if (version) {
       woothee_update_version(result, version);
       free(version);
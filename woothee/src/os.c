@@ -3,7 +3,8 @@
 #include "util.h"
 
 int
-woothee_os_challenge_windows(const char *ua, woothee_t *result)
+woothee_os_challenge_windows(const char *ua, woothee_t *result,
+                             const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
@@ -44,8 +45,8 @@ woothee_os_challenge_windows(const char *ua, woothee_t *result)
   } else if (strncmp(version, "NT 5.1", 6) == 0) {
     data = woothee_dataset_get(WinXP);
   } else if (woothee_match("^Phone", 0, version)) {
-    char *phone_version = woothee_match_get(
-      "Phone(?: OS)? ([.0-9]+)", 0, ua, 1);
+    char *phone_version = woothee_match_os_version(
+      scope, "Phone(?: OS)? ([.0-9]+)", 0, ua, 1);
     if (phone_version) {
       free(version);
       version = phone_version;
@@ -72,7 +73,8 @@ woothee_os_challenge_windows(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_osx(const char *ua, woothee_t *result)
+woothee_os_challenge_osx(const char *ua, woothee_t *result,
+                         const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
@@ -92,11 +94,12 @@ woothee_os_challenge_osx(const char *ua, woothee_t *result)
       data = woothee_dataset_get(iPod);
     }
 
-    version = woothee_match_get(
+    version = woothee_match_os_version(
+      scope,
       "; CPU(?: iPhone)? OS (\\d+_\\d+(?:_\\d+)?) like Mac OS X", 0, ua, 1);
   } else {
-    version = woothee_match_get(
-      "Mac OS X (10[._]\\d+(?:[._]\\d+)?)(?:\\)|;)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "Mac OS X (10[._]\\d+(?:[._]\\d+)?)(?:\\)|;)", 0, ua, 1);
   }
 
   woothee_update_category(result, data->category);
@@ -116,7 +119,8 @@ woothee_os_challenge_osx(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_linux(const char *ua, woothee_t *result)
+woothee_os_challenge_linux(const char *ua, woothee_t *result,
+                           const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
@@ -127,8 +131,8 @@ woothee_os_challenge_linux(const char *ua, woothee_t *result)
 
   if (strstr(ua, "Android") != NULL) {
     data = woothee_dataset_get(Android);
-    version = woothee_match_get(
-      "Android[- ](\\d+\\.\\d+(?:\\.\\d+)?)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "Android[- ](\\d+\\.\\d+(?:\\.\\d+)?)", 0, ua, 1);
   } else {
     data = woothee_dataset_get(Linux);
   }
@@ -144,7 +148,8 @@ woothee_os_challenge_linux(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_smartphone(const char *ua, woothee_t *result)
+woothee_os_challenge_smartphone(const char *ua, woothee_t *result,
+                                const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
@@ -161,10 +166,12 @@ woothee_os_challenge_smartphone(const char *ua, woothee_t *result)
     data = woothee_dataset_get(iOS);
   } else if (strstr(ua, "BB10") != NULL) {
     data = woothee_dataset_get(BlackBerry10);
-    version = woothee_match_get("BB10(?:.+)Version/([.0-9]+)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "BB10(?:.+)Version/([.0-9]+)", 0, ua, 1);
   } else if (strstr(ua, "BlackBerry") != NULL) {
     data = woothee_dataset_get(BlackBerry);
-    version = woothee_match_get("BlackBerry(?:\\d+)/([.0-9]+) ", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "BlackBerry(?:\\d+)/([.0-9]+) ", 0, ua, 1);
   }
 
   if (result->name) {
@@ -199,7 +206,8 @@ woothee_os_challenge_smartphone(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_mobilephone(const char *ua, woothee_t *result)
+woothee_os_challenge_mobilephone(const char *ua, woothee_t *result,
+                                 const woothee_scope_t *scope)
 {
   char *term = NULL;
   woothee_data_t *data = NULL;
@@ -252,7 +260,8 @@ woothee_os_challenge_mobilephone(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_appliance(const char *ua, woothee_t *result)
+woothee_os_challenge_appliance(const char *ua, woothee_t *result,
+                               const woothee_scope_t *scope)
 {
   woothee_data_t *data = NULL;
 
@@ -274,7 +283,8 @@ woothee_os_challenge_appliance(const char *ua, woothee_t *result)
 }
 
 int
-woothee_os_challenge_misc(const char *ua, woothee_t *result)
+woothee_os_challenge_misc(const char *ua, woothee_t *result,
+                          const woothee_scope_t *scope)
 {
   char *version = NULL;
   woothee_data_t *data = NULL;
@@ -284,15 +294,16 @@ woothee_os_challenge_misc(const char *ua, woothee_t *result)
     version = strdup("98");
   } else if (strstr(ua, "Macintosh; U; PPC;") != NULL) {
     data = woothee_dataset_get(MacOS);
-    version = woothee_match_get("rv:(\\d+\\.\\d+\\.\\d+)", 0, ua, 1);
+    version = woothee_match_os_version(
+      scope, "rv:(\\d+\\.\\d+\\.\\d+)", 0, ua, 1);
   } else if (strstr(ua, "Mac_PowerPC") != NULL) {
     data = woothee_dataset_get(MacOS);
   } else if (strstr(ua, "X11; FreeBSD ") != NULL) {
     data = woothee_dataset_get(BSD);
-    version = woothee_match_get("FreeBSD ([^;\\)]+)", 0, ua, 1);
+    version = woothee_match_os_version(scope, "FreeBSD ([^;\\)]+)", 0, ua, 1);
   } else if (strstr(ua, "X11; CrOS ") != NULL) {
     data = woothee_dataset_get(ChromeOS);
-    version = woothee_match_get("CrOS ([^\\)]+)\\)", 0, ua, 1);
+    version = woothee_match_os_version(scope, "CrOS ([^\\)]+)\\)", 0, ua, 1);
   }
 
   if (data) {
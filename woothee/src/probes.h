@@ -0,0 +1,25 @@
+#ifndef WOOTHEE_PROBES_H
+#define WOOTHEE_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/*
+ * Static probes (USDT) of the woothee provider, for perf, bpftrace or
+ * SystemTap. A probe is a single nop until a tracer attaches to it, and
+ * without sys/sdt.h the macros and their arguments compile away.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define WOOTHEE_PROBE1(name, a) DTRACE_PROBE1(woothee, name, a)
+#define WOOTHEE_PROBE2(name, a, b) DTRACE_PROBE2(woothee, name, a, b)
+#define WOOTHEE_PROBE3(name, a, b, c) DTRACE_PROBE3(woothee, name, a, b, c)
+#else
+#define WOOTHEE_PROBE1(name, a)
+#define WOOTHEE_PROBE2(name, a, b)
+#define WOOTHEE_PROBE3(name, a, b, c)
+#endif
+
+#endif
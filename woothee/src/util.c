@@ -1,6 +1,7 @@
 #include <pcre.h>
 
 #include "util.h"
+#include "probes.h"
 
 void
 woothee_update(woothee_t *target, woothee_data_t *source)
@@ -102,6 +103,9 @@ woothee_match(const char *regex, int caseless, const char *str)
   matched = pcre_exec(re, NULL, str, (int)strlen(str), 0, 0, &ovector, 1);
   pcre_free(re);
 
+  /* the pattern is a literal, its address identifies it */
+  WOOTHEE_PROBE3(regex__exec, regex, str, matched);
+
   if (matched < 0) {
     return 0;
   }
@@ -133,6 +137,8 @@ woothee_match_get(const char *regex, int caseless, const char *str, int n)
   matched = pcre_exec(re, NULL, str, (int)strlen(str), 0, 0, ovector, 16);
   pcre_free(re);
 
+  WOOTHEE_PROBE3(regex__exec, regex, str, matched);
+
   if (matched < 0) {
     return NULL;
   }
@@ -143,3 +149,111 @@ woothee_match_get(const char *regex, int caseless, const char *str, int n)
 
   return strndup(str + ovector[m], ovector[m+1] - ovector[m]);
 }
+
+/* woothee_match_get() for a version, skipped if the caller does not want it */
+char *
+woothee_match_version(const woothee_scope_t *scope, const char *regex,
+                      int caseless, const char *str, int n)
+{
+  if (!(scope->fields & WOOTHEE_FIELD_VERSION)) {
+    return NULL;
+  }
+
+  return woothee_match_get(regex, caseless, str, n);
+}
+
+char *
+woothee_match_os_version(const woothee_scope_t *scope, const char *regex,
+                         int caseless, const char *str, int n)
+{
+  if (!(scope->fields & WOOTHEE_FIELD_OS_VERSION)) {
+    return NULL;
+  }
+
+  return woothee_match_get(regex, caseless, str, n);
+}
+
+void
+woothee_tokenize(woothee_tokens_t *tokens, const char *ua)
+{
+  const char *p;
+
+  tokens->useragent = ua;
+  tokens->size = 0;
+
+  for (p = ua; (p = strchr(p, '/')) != NULL; p++) {
+    if (tokens->size == WOOTHEE_PRODUCT_SIZE) {
+      tokens->useragent = NULL;
+      return;
+    }
+    tokens->product[tokens->size].slash = (unsigned int)(p - ua);
+    tokens->product[tokens->size].version_len = strspn(p + 1, ".0123456789");
+    tokens->size++;
+  }
+}
+
+/* 1 when one of the '|' separated names ends right before ua[slash] */
+static int
+product_name(const char *ua, size_t slash, const char *names)
+{
+  const char *end;
+  size_t len;
+
+  for (;;) {
+    end = strchr(names, '|');
+    len = end ? (size_t)(end - names) : strlen(names);
+    if (len <= slash && memcmp(ua + slash - len, names, len) == 0) {
+      return 1;
+    }
+    if (!end) {
+      return 0;
+    }
+    names = end + 1;
+  }
+}
+
+/*
+ * The version of the first "(?:names)/([.0-9]+)" match, as
+ * woothee_match_get() gives it: every match ends at a slash, so the
+ * slashes are tried in order. The tokens of the parse are used when
+ * they are for this useragent, else the slashes are searched again.
+ */
+char *
+woothee_product_get(const woothee_scope_t *scope, const char *ua,
+                    const char *names)
+{
+  const woothee_tokens_t *tokens = scope ? scope->tokens : NULL;
+  const woothee_product_t *product;
+  const char *p;
+  size_t i, len;
+
+  if (tokens && tokens->useragent == ua) {
+    for (i = 0; i < tokens->size; i++) {
+      product = &tokens->product[i];
+      if (product->version_len > 0
+          && product_name(ua, product->slash, names)) {
+        return strndup(ua + product->slash + 1, product->version_len);
+      }
+    }
+    return NULL;
+  }
+
+  for (p = ua; (p = strchr(p, '/')) != NULL; p++) {
+    len = strspn(p + 1, ".0123456789");
+    if (len > 0 && product_name(ua, p - ua, names)) {
+      return strndup(p + 1, len);
+    }
+  }
+  return NULL;
+}
+
+char *
+woothee_product_version(const woothee_scope_t *scope, const char *ua,
+                        const char *names)
+{
+  if (!(scope->fields & WOOTHEE_FIELD_VERSION)) {
+    return NULL;
+  }
+
+  return woothee_product_get(scope, ua, names);
+}
@@ -3,6 +3,34 @@
 
 #include "woothee.h"
 
+#define WOOTHEE_PRODUCT_SIZE 32
+
+/*
+ * The "name/version" products of a useragent, split by one pass of
+ * woothee_tokenize(): the offset of each '/' and the length of the
+ * [.0-9]* run after it. A name is whatever ends at the slash.
+ */
+typedef struct {
+  unsigned int slash;
+  unsigned int version_len;
+} woothee_product_t;
+
+typedef struct {
+  const char *useragent; /* NULL when it has too many products */
+  size_t size;
+  woothee_product_t product[WOOTHEE_PRODUCT_SIZE];
+} woothee_tokens_t;
+
+/*
+ * What a parse asks of the challenges, besides the useragent: the
+ * WOOTHEE_FIELD_* to fill, others may be left UNKNOWN, and the products
+ * of the useragent, NULL when it was not split.
+ */
+typedef struct {
+  unsigned int fields;
+  const woothee_tokens_t *tokens;
+} woothee_scope_t;
+
 void woothee_update(woothee_t *result, woothee_data_t *source);
 void woothee_update_category(woothee_t *target, char *category);
 void woothee_update_version(woothee_t *target, char *version);
@@ -11,5 +39,17 @@ void woothee_update_os_version(woothee_t *target, char *version);
 
 int woothee_match(const char *regex, int caseless, const char *str);
 char * woothee_match_get(const char *regex, int caseless, const char *str, int n);
+char * woothee_match_version(const woothee_scope_t *scope,
+                             const char *regex, int caseless,
+                             const char *str, int n);
+char * woothee_match_os_version(const woothee_scope_t *scope,
+                                const char *regex, int caseless,
+                                const char *str, int n);
+
+void woothee_tokenize(woothee_tokens_t *tokens, const char *ua);
+char * woothee_product_get(const woothee_scope_t *scope, const char *ua,
+                           const char *names);
+char * woothee_product_version(const woothee_scope_t *scope, const char *ua,
+                               const char *names);
 
 #endif
@@ -1,3 +1,5 @@
+#include <time.h>
+
 #include "woothee.h"
 #include "crawler.h"
 #include "browser.h"
@@ -5,9 +7,12 @@
 #include "mobilephone.h"
 #include "appliance.h"
 #include "misc.h"
+#include "fastpath.h"
+#include "util.h"
 #include "dataset.h"
+#include "probes.h"
 
-static woothee_t *
+woothee_t *
 woothee_create(void)
 {
   woothee_t *self;
@@ -18,6 +23,7 @@ woothee_create(void)
     return NULL;
   }
   memset(self, 0, sizeof(woothee_t));
+  woothee_update_numbers(self);
 
   return self;
 }
@@ -51,205 +57,499 @@ woothee_delete(woothee_t *self)
   free(self);
 }
 
-static int
-try_crawler(const char *useragent, woothee_t *result)
+/*
+ * Challenge rules in the order they are tried. Each try_* group runs a
+ * contiguous range of this table.
+ *
+ * A rule gate lists literals of which the useragent must contain at least
+ * one for the challenge to succeed, NULL when there is no such cheap test.
+ * Challenges never touch the result when they fail, so skipping a rule
+ * whose gate fails can not change the outcome.
+ */
+typedef int (*woothee_challenge_fn)(const char *ua, woothee_t *result,
+                                    const woothee_scope_t *scope);
+
+typedef struct {
+  const char *name;
+  woothee_challenge_fn fn;
+  const char * const *gate;
+} woothee_rule_t;
+
+enum {
+  RULE_CRAWLER_GOOGLE,
+  RULE_CRAWLER_CRAWLERS,
+  RULE_BROWSER_MSIE,
+  RULE_BROWSER_SAFARI_CHROME,
+  RULE_BROWSER_FIREFOX,
+  RULE_BROWSER_OPERA,
+  RULE_BROWSER_WEBVIEW,
+  RULE_OS_WINDOWS,
+  RULE_OS_OSX,
+  RULE_OS_LINUX,
+  RULE_OS_SMARTPHONE,
+  RULE_OS_MOBILEPHONE,
+  RULE_OS_APPLIANCE,
+  RULE_OS_MISC,
+  RULE_MOBILEPHONE_DOCOMO,
+  RULE_MOBILEPHONE_AU,
+  RULE_MOBILEPHONE_SOFTBANK,
+  RULE_MOBILEPHONE_WILLCOM,
+  RULE_MOBILEPHONE_MISC,
+  RULE_APPLIANCE_PLAYSTATION,
+  RULE_APPLIANCE_NINTENDO,
+  RULE_APPLIANCE_DIGITALTV,
+  RULE_MISC_DESKTOPTOOLS,
+  RULE_MISC_SMARTPHONE_PATTERNS,
+  RULE_BROWSER_SLEIPNIR,
+  RULE_MISC_HTTP_LIBRARY,
+  RULE_MISC_MAYBE_RSS_READER,
+  RULE_CRAWLER_MAYBE_CRAWLER,
+  RULE_SIZE
+};
+
+/*
+ * The fastpath is profiled as one more rule after the challenges. It is
+ * not part of any group, so the adaptive order leaves it out.
+ */
+#define RULE_FASTPATH RULE_SIZE
+#define RULE_STAT_SIZE (RULE_SIZE + 1)
+
+static const char * const gate_google[] = { "Google", NULL };
+static const char * const gate_msie[] = {
+  "compatible; MSIE", "Trident/", "IEMobile", NULL
+};
+static const char * const gate_safari[] = { "Safari/", NULL };
+static const char * const gate_firefox[] = { "Firefox/", NULL };
+static const char * const gate_opera[] = { "Opera", NULL };
+static const char * const gate_webview[] = { "like Mac OS X", NULL };
+static const char * const gate_windows[] = { "Windows", NULL };
+static const char * const gate_osx[] = { "Mac OS X", NULL };
+static const char * const gate_linux[] = { "Linux", NULL };
+/* Firefox OS is only detected on top of a Firefox result */
+static const char * const gate_os_smartphone[] = {
+  "iPhone", "iPad", "iPod", "Android", "CFNetwork", "BB10", "BlackBerry",
+  "Firefox/", NULL
+};
+static const char * const gate_os_mobilephone[] = {
+  "KDDI-", "WILLCOM", "DDIPOCKET", "SymbianOS", "Google Wireless Transcoder",
+  "Naver Transcoder", NULL
+};
+static const char * const gate_os_appliance[] = {
+  "Nintendo DSi;", "Nintendo Wii;", NULL
+};
+static const char * const gate_os_misc[] = {
+  "(Win98;", "Macintosh; U; PPC;", "Mac_PowerPC", "X11; FreeBSD ",
+  "X11; CrOS ", NULL
+};
+static const char * const gate_docomo[] = { "DoCoMo", ";FOMA;", NULL };
+static const char * const gate_au[] = { "KDDI-", NULL };
+static const char * const gate_softbank[] = {
+  "SoftBank", "Vodafone", "J-PHONE", NULL
+};
+static const char * const gate_willcom[] = { "WILLCOM", "DDIPOCKET", NULL };
+static const char * const gate_mobilephone_misc[] = {
+  "jig browser", "emobile/", "OpenBrowser", "Browser/Obigo-Browser",
+  "SymbianOS", "Hatena-Mobile-Gateway/", "livedoor-Mobile-Gateway/", NULL
+};
+static const char * const gate_playstation[] = {
+  "PSP (PlayStation Portable);", "PlayStation Vita", "PLAYSTATION 3",
+  "PlayStation 4 ", NULL
+};
+static const char * const gate_nintendo[] = {
+  "Nintendo 3DS;", "Nintendo DSi;", "Nintendo Wii;", "(Nintendo WiiU)", NULL
+};
+static const char * const gate_digitaltv[] = { "InettvBrowser/", NULL };
+static const char * const gate_desktoptools[] = {
+  "AppleSyndication/", "compatible; Google Desktop/", "Windows-RSS-Platform",
+  NULL
+};
+static const char * const gate_smartphone_patterns[] = { "CFNetwork/", NULL };
+static const char * const gate_sleipnir[] = { "Sleipnir/", NULL };
+
+static const woothee_rule_t rules[RULE_STAT_SIZE] = {
+  { "crawler_google", woothee_crawler_challenge_google, gate_google },
+  { "crawler_crawlers", woothee_crawler_challenge_crawlers, NULL },
+  { "browser_msie", woothee_browser_challenge_msie, gate_msie },
+  { "browser_safari_chrome", woothee_browser_challenge_safari_chrome,
+    gate_safari },
+  { "browser_firefox", woothee_browser_challenge_firefox, gate_firefox },
+  { "browser_opera", woothee_browser_challenge_opera, gate_opera },
+  { "browser_webview", woothee_browser_challenge_webview, gate_webview },
+  { "os_windows", woothee_os_challenge_windows, gate_windows },
+  /* OSX PC and iOS devices (strict check) */
+  { "os_osx", woothee_os_challenge_osx, gate_osx },
+  /* Linux PC and Android */
+  { "os_linux", woothee_os_challenge_linux, gate_linux },
+  /* all useragents matches /(iPhone|iPad|iPod|Android|BlackBerry)/ */
+  { "os_smartphone", woothee_os_challenge_smartphone, gate_os_smartphone },
+  /* mobile phones like KDDI-.* */
+  { "os_mobilephone", woothee_os_challenge_mobilephone, gate_os_mobilephone },
+  /* Nintendo DSi/Wii with Opera */
+  { "os_appliance", woothee_os_challenge_appliance, gate_os_appliance },
+  /* Win98, BSD, classic MacOS, ... */
+  { "os_misc", woothee_os_challenge_misc, gate_os_misc },
+  { "mobilephone_docomo", woothee_mobilephone_challenge_docomo, gate_docomo },
+  { "mobilephone_au", woothee_mobilephone_challenge_au, gate_au },
+  { "mobilephone_softbank", woothee_mobilephone_challenge_softbank,
+    gate_softbank },
+  { "mobilephone_willcom", woothee_mobilephone_challenge_willcom,
+    gate_willcom },
+  { "mobilephone_misc", woothee_mobilephone_challenge_misc,
+    gate_mobilephone_misc },
+  { "appliance_playstation", woothee_appliance_challenge_playstation,
+    gate_playstation },
+  { "appliance_nintendo", woothee_appliance_challenge_nintendo,
+    gate_nintendo },
+  { "appliance_digitaltv", woothee_appliance_challenge_digitaltv,
+    gate_digitaltv },
+  { "misc_desktoptools", woothee_misc_challenge_desktoptools,
+    gate_desktoptools },
+  { "misc_smartphone_patterns", woothee_misc_challenge_smartphone_patterns,
+    gate_smartphone_patterns },
+  { "browser_sleipnir", woothee_browser_challenge_sleipnir, gate_sleipnir },
+  { "misc_http_library", woothee_misc_challenge_http_library, NULL },
+  { "misc_maybe_rss_reader", woothee_misc_challenge_maybe_rss_reader, NULL },
+  { "crawler_maybe_crawler", woothee_crawler_challenge_maybe_crawler, NULL },
+  { "fastpath", woothee_fastpath, NULL },
+};
+
+/* Challenge groups, the rules first..last of each try_* */
+enum {
+  GROUP_CRAWLER,
+  GROUP_BROWSER,
+  GROUP_OS,
+  GROUP_MOBILEPHONE,
+  GROUP_APPLIANCE,
+  GROUP_MISC,
+  GROUP_RARE_CASES,
+  GROUP_SIZE
+};
+
+static const struct {
+  const char *name;
+  int first;
+  int last;
+} groups[GROUP_SIZE] = {
+  { "crawler", RULE_CRAWLER_GOOGLE, RULE_CRAWLER_CRAWLERS },
+  { "browser", RULE_BROWSER_MSIE, RULE_BROWSER_WEBVIEW },
+  { "os", RULE_OS_WINDOWS, RULE_OS_MISC },
+  { "mobilephone", RULE_MOBILEPHONE_DOCOMO, RULE_MOBILEPHONE_MISC },
+  { "appliance", RULE_APPLIANCE_PLAYSTATION, RULE_APPLIANCE_DIGITALTV },
+  { "misc", RULE_MISC_DESKTOPTOOLS, RULE_MISC_DESKTOPTOOLS },
+  { "rare_cases", RULE_MISC_SMARTPHONE_PATTERNS, RULE_CRAWLER_MAYBE_CRAWLER },
+};
+
+/* groups left out of exec_parse(), set by woothee_groups_disable() */
+static unsigned int disabled_groups = 0;
+
+#define GROUP_ENABLED(group) (!(disabled_groups & (1U << (group))))
+
+/*
+ * Adaptive rule order: each group is tried most hit rule first. The
+ * order is recomputed from the hit counts every period parses.
+ */
+struct woothee_order_s {
+  unsigned char rule[RULE_SIZE]; /* rule ids, permuted within each group */
+  unsigned long hits[RULE_SIZE];
+  unsigned int parses;
+  unsigned int period;
+};
+
+typedef struct {
+  const char *useragent;
+  woothee_t *result;
+  woothee_rule_stat_t *stats; /* NULL unless profiled */
+  woothee_order_t *order;     /* NULL for the fixed order */
+  unsigned int depth;         /* challenges run so far */
+  woothee_scope_t scope;      /* fields and tokens, for the challenges */
+} woothee_parse_ctx;
+
+/* profiled parses time each challenge, set by woothee_rule_timing() */
+static int rule_timing = 1;
+
+/* exec_parse() tries the fastpath first, set by woothee_fastpath_enable() */
+static int fastpath_enabled = 1;
+
+static unsigned long long
+woothee_nsec(void)
 {
-  if (woothee_crawler_challenge_google(useragent, result)) {
-    return 1;
-  }
-  if (woothee_crawler_challenge_crawlers(useragent, result)) {
-    return 1;
-  }
-  return 0;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 static int
-try_browser(const char *useragent, woothee_t *result)
+challenge(woothee_parse_ctx *ctx, int id)
 {
-  if (woothee_browser_challenge_msie(useragent, result)) {
-    return 1;
-  }
-  if (woothee_browser_challenge_safari_chrome(useragent, result)) {
-    return 1;
+  woothee_rule_stat_t *stat;
+  unsigned long long start;
+  int hit;
+
+  if (!ctx->stats) {
+    hit = rules[id].fn(ctx->useragent, ctx->result, &ctx->scope);
+    if (hit && id != RULE_FASTPATH) {
+      WOOTHEE_PROBE2(challenge__hit, id, rules[id].name);
+    }
+    return hit;
   }
-  if (woothee_browser_challenge_firefox(useragent, result)) {
-    return 1;
+
+  stat = &ctx->stats[id];
+  if (rule_timing) {
+    start = woothee_nsec();
+    hit = rules[id].fn(ctx->useragent, ctx->result, &ctx->scope);
+    stat->nsec += woothee_nsec() - start;
+  } else {
+    hit = rules[id].fn(ctx->useragent, ctx->result, &ctx->scope);
   }
-  if (woothee_browser_challenge_opera(useragent, result)) {
-    return 1;
+  if (hit && id != RULE_FASTPATH) {
+    WOOTHEE_PROBE2(challenge__hit, id, rules[id].name);
   }
-  if (woothee_browser_challenge_webview(useragent, result)) {
-    return 1;
+  stat->calls++;
+  if (hit) {
+    stat->hits++;
+    stat->depth += ctx->depth;
   }
-  return 0;
+  ctx->depth++;
+
+  return hit;
 }
 
+/* 0 when the rule can not succeed on the useragent */
 static int
-try_os(const char *useragent, woothee_t *result)
+gate_pass(const char *useragent, int id)
 {
-  if (woothee_os_challenge_windows(useragent, result)) {
-    return 1;
-  }
+  const char * const *literal = rules[id].gate;
 
-  /* OSX PC and iOS devices (strict check) */
-  if (woothee_os_challenge_osx(useragent, result)) {
+  if (!literal) {
     return 1;
   }
 
-  /* Linux PC and Android */
-  if (woothee_os_challenge_linux(useragent, result)) {
-    return 1;
-  }
-
-  /* all useragents matches /(iPhone|iPad|iPod|Android|BlackBerry)/ */
-  if (woothee_os_challenge_smartphone(useragent, result)) {
-    return 1;
+  for (; *literal; literal++) {
+    if (strstr(useragent, *literal) != NULL) {
+      return 1;
+    }
   }
+  return 0;
+}
 
-  /* mobile phones like KDDI-.* */
-  if (woothee_os_challenge_mobilephone(useragent, result)) {
-    return 1;
-  }
+/*
+ * Run the group in its adaptive order. A rule only runs once every rule
+ * before it in the fixed order is known to fail, by having run or by its
+ * gate, so the first hit is the same as in the fixed order. When that
+ * can not be shown the rest of the group runs in the fixed order.
+ */
+static int
+try_group_adaptive(woothee_parse_ctx *ctx, int first, int last)
+{
+  woothee_order_t *order = ctx->order;
+  unsigned long failed = 0;
+  int i, id, before;
+
+  for (i = first; i <= last; i++) {
+    id = order->rule[i];
+    for (before = first; before < id; before++) {
+      if (failed & (1UL << (before - first))) {
+        continue;
+      }
+      if (gate_pass(ctx->useragent, before)) {
+        goto fixed;
+      }
+      failed |= 1UL << (before - first);
+    }
 
-  /* Nintendo DSi/Wii with Opera */
-  if (woothee_os_challenge_appliance(useragent, result)) {
-    return 1;
+    if (challenge(ctx, id)) {
+      order->hits[id]++;
+      return 1;
+    }
+    failed |= 1UL << (id - first);
   }
+  return 0;
 
-  /* Win98, BSD, classic MacOS, ... */
-  if (woothee_os_challenge_misc(useragent, result)) {
-    return 1;
+fixed:
+  for (id = first; id <= last; id++) {
+    if (failed & (1UL << (id - first))) {
+      continue;
+    }
+    if (challenge(ctx, id)) {
+      order->hits[id]++;
+      return 1;
+    }
   }
-
   return 0;
 }
 
+/* run the rules of the group, stopping at the first hit */
 static int
-try_mobilephone(const char *useragent, woothee_t *result)
+try_group(woothee_parse_ctx *ctx, int group)
 {
-  if (woothee_mobilephone_challenge_docomo(useragent, result)) {
-    return 1;
-  }
-  if (woothee_mobilephone_challenge_au(useragent, result)) {
-    return 1;
-  }
-  if (woothee_mobilephone_challenge_softbank(useragent, result)) {
-    return 1;
-  }
-  if (woothee_mobilephone_challenge_willcom(useragent, result)) {
-    return 1;
+  int id;
+
+  if (ctx->order) {
+    return try_group_adaptive(ctx, groups[group].first, groups[group].last);
   }
-  if (woothee_mobilephone_challenge_misc(useragent, result)) {
-    return 1;
+
+  for (id = groups[group].first; id <= groups[group].last; id++) {
+    if (challenge(ctx, id)) {
+      return 1;
+    }
   }
   return 0;
 }
 
 static int
-try_appliance(const char *useragent, woothee_t *result)
+try_crawler(woothee_parse_ctx *ctx)
 {
-  if (woothee_appliance_challenge_playstation(useragent, result)) {
-    return 1;
-  }
-  if (woothee_appliance_challenge_nintendo(useragent, result)) {
-    return 1;
-  }
-  if (woothee_appliance_challenge_digitaltv(useragent, result)) {
-    return 1;
-  }
-  return 0;
+  return try_group(ctx, GROUP_CRAWLER);
 }
 
 static int
-try_misc(const char *useragent, woothee_t *result)
+try_browser(woothee_parse_ctx *ctx)
 {
-  if (woothee_misc_challenge_desktoptools(useragent, result)) {
-    return 1;
-  }
-  return 0;
+  return try_group(ctx, GROUP_BROWSER);
 }
 
 static int
-try_rare_cases(const char *useragent, woothee_t *result)
+try_os(woothee_parse_ctx *ctx)
 {
-  if (woothee_misc_challenge_smartphone_patterns(useragent, result)) {
-    return 1;
-  }
+  return try_group(ctx, GROUP_OS);
+}
 
-  if (woothee_browser_challenge_sleipnir(useragent, result)) {
-    return 1;
-  }
+static int
+try_mobilephone(woothee_parse_ctx *ctx)
+{
+  return try_group(ctx, GROUP_MOBILEPHONE);
+}
 
-  if (woothee_misc_challenge_http_library(useragent, result)) {
-    return 1;
-  }
+static int
+try_appliance(woothee_parse_ctx *ctx)
+{
+  return try_group(ctx, GROUP_APPLIANCE);
+}
 
-  if (woothee_misc_challenge_maybe_rss_reader(useragent, result)) {
-    return 1;
-  }
+static int
+try_misc(woothee_parse_ctx *ctx)
+{
+  return try_group(ctx, GROUP_MISC);
+}
 
-  if (woothee_crawler_challenge_maybe_crawler(useragent, result)) {
-    return 1;
+static int
+try_rare_cases(woothee_parse_ctx *ctx)
+{
+  return try_group(ctx, GROUP_RARE_CASES);
+}
+
+/* sort each group by hits, ties in the fixed order, then decay the hits */
+static void
+order_update(woothee_order_t *order)
+{
+  int g, i, j, id;
+
+  for (g = 0; g < GROUP_SIZE; g++) {
+    for (i = groups[g].first + 1; i <= groups[g].last; i++) {
+      id = order->rule[i];
+      for (j = i; j > groups[g].first; j--) {
+        int prev = order->rule[j - 1];
+        if (order->hits[prev] > order->hits[id]
+            || (order->hits[prev] == order->hits[id] && prev < id)) {
+          break;
+        }
+        order->rule[j] = prev;
+      }
+      order->rule[j] = id;
+    }
   }
 
-  return 0;
+  for (i = 0; i < RULE_SIZE; i++) {
+    order->hits[i] /= 2;
+  }
 }
 
-static woothee_t *
-exec_parse(const char *useragent)
+/* the challenge groups, in order, until one classifies the useragent */
+static void
+exec_groups(woothee_parse_ctx *ctx)
 {
-  woothee_t *result;
+  if (GROUP_ENABLED(GROUP_CRAWLER) && try_crawler(ctx)) {
+    return;
+  }
 
-  if (!useragent || strlen(useragent) < 1 || strcmp(useragent, "-") == 0) {
-    return NULL;
+  if (GROUP_ENABLED(GROUP_BROWSER) && try_browser(ctx)) {
+    if (GROUP_ENABLED(GROUP_OS)) {
+      try_os(ctx);
+    }
+    return;
   }
 
-  result = woothee_create();
-  if (!result) {
-    return NULL;
+  if (GROUP_ENABLED(GROUP_MOBILEPHONE) && try_mobilephone(ctx)) {
+    return;
   }
 
-  if (try_crawler(useragent, result)) {
-    return result;
+  if (GROUP_ENABLED(GROUP_APPLIANCE) && try_appliance(ctx)) {
+    return;
   }
 
-  if (try_browser(useragent, result)) {
-    if (try_os(useragent, result)) {
-      return result;
-    } else {
-      return result;
-    }
+  if (GROUP_ENABLED(GROUP_MISC) && try_misc(ctx)) {
+    return;
   }
 
-  if (try_mobilephone(useragent, result)) {
-      return result;
+  /* browser unknown. check os only */
+  if (GROUP_ENABLED(GROUP_OS) && try_os(ctx)) {
+    return;
   }
 
-  if (try_appliance(useragent, result)) {
-      return result;
+  if (GROUP_ENABLED(GROUP_RARE_CASES)) {
+    try_rare_cases(ctx);
   }
+}
 
-  if (try_misc(useragent, result)) {
-      return result;
+static woothee_t *
+exec_parse(const char *useragent, woothee_rule_stat_t *stats,
+           woothee_order_t *order, unsigned int fields)
+{
+  woothee_parse_ctx ctx;
+  woothee_tokens_t tokens;
+
+  if (!useragent || strlen(useragent) < 1 || strcmp(useragent, "-") == 0) {
+    return NULL;
   }
 
-  /* browser unknown. check os only */
-  if (try_os(useragent, result)) {
-      return result;
+  ctx.useragent = useragent;
+  ctx.stats = stats;
+  ctx.order = order;
+  ctx.depth = 0;
+  ctx.scope.fields = fields;
+  ctx.scope.tokens = NULL;
+  ctx.result = woothee_create();
+  if (!ctx.result) {
+    return NULL;
   }
 
-  if (try_rare_cases(useragent, result)) {
-    return result;
+  if (order && ++order->parses >= order->period) {
+    order->parses = 0;
+    order_update(order);
   }
 
-  return result;
+  /* the common Mozilla/5.0 browsers, as the browser and os groups say */
+  if (fastpath_enabled
+      && GROUP_ENABLED(GROUP_BROWSER) && GROUP_ENABLED(GROUP_OS)
+      && challenge(&ctx, RULE_FASTPATH)) {
+    WOOTHEE_PROBE1(fastpath__hit, useragent);
+    return ctx.result;
+  }
+
+  /* split once, for the product lookups of the challenges */
+  woothee_tokenize(&tokens, useragent);
+  ctx.scope.tokens = &tokens;
+
+  exec_groups(&ctx);
+
+  return ctx.result;
 }
 
-woothee_t *
-woothee_parse(const char *useragent)
+static woothee_t *
+fill_unknown(woothee_t *result)
 {
-  woothee_t *result = exec_parse(useragent);
-
   if (!result) {
     return NULL;
   }
@@ -276,26 +576,371 @@ woothee_parse(const char *useragent)
   return result;
 }
 
+static woothee_t *
+parse(const char *useragent, woothee_rule_stat_t *stats,
+      woothee_order_t *order, unsigned int fields)
+{
+  woothee_t *result;
+
+  WOOTHEE_PROBE2(parse__start, useragent,
+                 useragent ? strlen(useragent) : 0);
+
+  result = fill_unknown(exec_parse(useragent, stats, order, fields));
+  woothee_update_numbers(result);
+
+  WOOTHEE_PROBE3(parse__end, useragent,
+                 useragent ? strlen(useragent) : 0,
+                 result ? result->name : NULL);
+
+  return result;
+}
+
+woothee_t *
+woothee_parse(const char *useragent)
+{
+  return parse(useragent, NULL, NULL, WOOTHEE_FIELD_ALL);
+}
+
+/*
+ * Parse for the WOOTHEE_FIELD_* in fields only: version and os_version
+ * regexes are not run unless asked for. Fields not asked for may be left
+ * UNKNOWN.
+ */
+woothee_t *
+woothee_parse_fields(const char *useragent, unsigned int fields)
+{
+  return parse(useragent, NULL, NULL, fields);
+}
+
+woothee_t *
+woothee_parse_profiled(const char *useragent, woothee_rule_stat_t *stats)
+{
+  return parse(useragent, stats, NULL, WOOTHEE_FIELD_ALL);
+}
+
+woothee_t *
+woothee_parse_adaptive(const char *useragent, woothee_order_t *order,
+                       woothee_rule_stat_t *stats, unsigned int fields)
+{
+  return parse(useragent, stats, order, fields);
+}
+
+woothee_order_t *
+woothee_order_create(unsigned int period)
+{
+  woothee_order_t *order;
+  int i;
+
+  order = (woothee_order_t *)malloc(sizeof(woothee_order_t));
+  if (!order) {
+    fprintf(stderr, "ERROR: Cannot allocate memory\n");
+    return NULL;
+  }
+  memset(order, 0, sizeof(woothee_order_t));
+
+  for (i = 0; i < RULE_SIZE; i++) {
+    order->rule[i] = (unsigned char)i;
+  }
+  order->period = period ? period : 1;
+
+  return order;
+}
+
+void
+woothee_order_delete(woothee_order_t *order)
+{
+  free(order);
+}
+
+/* the challenges, then the fastpath pseudo-rule */
+int
+woothee_rule_size(void)
+{
+  return RULE_STAT_SIZE;
+}
+
+/*
+ * Whether profiled parses time each challenge into the nsec of its
+ * woothee_rule_stat_t, on by default. Calls, hits and depth are counted
+ * either way. Not thread safe: call it before parsing starts.
+ */
+void
+woothee_rule_timing(int enable)
+{
+  rule_timing = enable;
+}
+
+/*
+ * Whether parses try the fastpath before the challenges, on by default.
+ * The results are the same either way; this is for comparing parse times.
+ * Not thread safe: call it before parsing starts.
+ */
+void
+woothee_fastpath_enable(int enable)
+{
+  fastpath_enabled = enable;
+}
+
+const char *
+woothee_rule_name(int id)
+{
+  if (id < 0 || id >= RULE_STAT_SIZE) {
+    return NULL;
+  }
+
+  return rules[id].name;
+}
+
 int
 woothee_is_crawler(const char *useragent)
 {
-  woothee_t *result;
+  woothee_parse_ctx ctx;
   int is_crawler = 0;
 
   if (!useragent || strlen(useragent) < 1 || strcmp(useragent, "-") == 0) {
     return is_crawler;
   }
 
-  result = woothee_create();
-  if (!result) {
+  is_crawler = woothee_crawler_literal(useragent);
+  if (is_crawler >= 0) {
     return is_crawler;
   }
+  is_crawler = 0;
 
-  if (try_crawler(useragent, result)) {
+  ctx.useragent = useragent;
+  ctx.stats = NULL;
+  ctx.order = NULL;
+  ctx.depth = 0;
+  ctx.scope.fields = WOOTHEE_FIELD_ALL;
+  ctx.scope.tokens = NULL;
+  ctx.result = woothee_create();
+  if (!ctx.result) {
+    return is_crawler;
+  }
+
+  if (try_crawler(&ctx)) {
     is_crawler = 1;
   }
 
+  woothee_delete(ctx.result);
+
+  return is_crawler;
+}
+
+/*
+ * woothee_is_crawler(), or the bot, crawler and spider patterns that a
+ * parse falls back on for VariousCrawler. At the start of a token they
+ * are looked for whatever other challenges match, so a browser useragent
+ * ending in " FooBot/1.0" is a crawler here while woothee_parse() reports
+ * the browser. At the end of a longer word ("FooSpider/1.0", the "CUBOT"
+ * phones) they are left to a parse, which only falls back on them when
+ * no browser or os matched.
+ */
+int
+woothee_maybe_crawler(const char *useragent)
+{
+  woothee_t *result;
+  int is_crawler;
+
+  if (woothee_is_crawler(useragent)) {
+    return 1;
+  }
+  if (!useragent) {
+    return 0;
+  }
+
+  switch (woothee_crawler_maybe_literal(useragent)) {
+    case WOOTHEE_CRAWLER_MAYBE_TOKEN:
+      return 1;
+    case WOOTHEE_CRAWLER_MAYBE_INSIDE:
+      break;
+    default:
+      return 0;
+  }
+
+  result = woothee_parse_fields(useragent,
+                                WOOTHEE_FIELD_NAME | WOOTHEE_FIELD_CATEGORY);
+  if (!result) {
+    return 0;
+  }
+  is_crawler = (woothee_category_id(result->category)
+                == WOOTHEE_CATEGORY_CRAWLER);
   woothee_delete(result);
 
   return is_crawler;
 }
+
+int
+woothee_dataset_size(void)
+{
+  return WOOTHEE_DATASET_SIZE;
+}
+
+woothee_data_t *
+woothee_dataset_at(int index)
+{
+  if (index < 0 || index >= WOOTHEE_DATASET_SIZE) {
+    return NULL;
+  }
+
+  return (woothee_data_t *)&dataset + index;
+}
+
+int
+woothee_dataset_index(const char *name)
+{
+  woothee_data_t *data = (woothee_data_t *)&dataset;
+  int i;
+
+  if (!name) {
+    return -1;
+  }
+
+  for (i = 0; i < WOOTHEE_DATASET_SIZE; i++) {
+    if (strcmp(data[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+int
+woothee_group_size(void)
+{
+  return GROUP_SIZE;
+}
+
+const char *
+woothee_group_name(int id)
+{
+  if (id < 0 || id >= GROUP_SIZE) {
+    return NULL;
+  }
+
+  return groups[id].name;
+}
+
+int
+woothee_group_index(const char *name)
+{
+  int i;
+
+  if (!name) {
+    return -1;
+  }
+
+  for (i = 0; i < GROUP_SIZE; i++) {
+    if (strcmp(groups[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Leave the groups in mask (1 << woothee_group_index()) out of every
+ * following parse, 0 enables them all again. User-Agents that only a
+ * disabled group classifies are parsed as the next group that matches,
+ * or UNKNOWN. woothee_is_crawler() is not affected. Not thread safe: call
+ * it before parsing starts.
+ */
+void
+woothee_groups_disable(unsigned int mask)
+{
+  disabled_groups = mask;
+}
+
+static const char *categories[WOOTHEE_CATEGORY_SIZE] = {
+  "pc", "smartphone", "mobilephone", "appliance", "crawler", "misc",
+  WOOTHEE_DATASET_VALUE_UNKNOWN
+};
+
+int
+woothee_category_id(const char *category)
+{
+  int i;
+
+  if (!category) {
+    return WOOTHEE_CATEGORY_UNKNOWN;
+  }
+
+  for (i = 0; i < WOOTHEE_CATEGORY_UNKNOWN; i++) {
+    if (strcmp(categories[i], category) == 0) {
+      return i;
+    }
+  }
+
+  return WOOTHEE_CATEGORY_UNKNOWN;
+}
+
+const char *
+woothee_category_name(int id)
+{
+  if (id < 0 || id >= WOOTHEE_CATEGORY_SIZE) {
+    return NULL;
+  }
+
+  return categories[id];
+}
+
+/*
+ * Split a version into its leading numbers: "44.0.2403.155" is 44, 0, 2403
+ * and "NT 10.0" is 10, 0, -1. Parts not present are -1. Returns the number
+ * of parts found.
+ */
+int
+woothee_version_split(const char *version, int *major, int *minor, int *patch)
+{
+  int *parts[3];
+  int i, n = 0;
+
+  parts[0] = major;
+  parts[1] = minor;
+  parts[2] = patch;
+  for (i = 0; i < 3; i++) {
+    *parts[i] = -1;
+  }
+
+  if (!version) {
+    return 0;
+  }
+
+  while (*version && (*version < '0' || *version > '9')) {
+    version++;
+  }
+
+  while (n < 3 && *version >= '0' && *version <= '9') {
+    int value = 0;
+
+    while (*version >= '0' && *version <= '9') {
+      if (value < 100000000) {
+        value = value * 10 + (*version - '0');
+      }
+      version++;
+    }
+    *parts[n++] = value;
+
+    if ((*version != '.' && *version != '_')
+        || version[1] < '0' || version[1] > '9') {
+      break;
+    }
+    version++;
+  }
+
+  return n;
+}
+
+void
+woothee_update_numbers(woothee_t *self)
+{
+  if (!self) {
+    return;
+  }
+
+  woothee_version_split(self->version, &self->version_major,
+                        &self->version_minor, &self->version_patch);
+  woothee_version_split(self->os_version, &self->os_version_major,
+                        &self->os_version_minor, &self->os_version_patch);
+}
@@ -14,12 +14,114 @@ typedef struct {
   char *os_version;
   char *version;
   char *vendor;
+  /* numeric parts of version and os_version, -1 where absent */
+  int version_major;
+  int version_minor;
+  int version_patch;
+  int os_version_major;
+  int os_version_minor;
+  int os_version_patch;
 } woothee_t;
 
+/* Fields for woothee_parse_fields() */
+#define WOOTHEE_FIELD_NAME       0x01
+#define WOOTHEE_FIELD_CATEGORY   0x02
+#define WOOTHEE_FIELD_OS         0x04
+#define WOOTHEE_FIELD_OS_VERSION 0x08
+#define WOOTHEE_FIELD_VERSION    0x10
+#define WOOTHEE_FIELD_VENDOR     0x20
+#define WOOTHEE_FIELD_ALL        0x3f
+
+/* Category ids, in the order of woothee_category_name() */
+enum {
+  WOOTHEE_CATEGORY_PC,
+  WOOTHEE_CATEGORY_SMARTPHONE,
+  WOOTHEE_CATEGORY_MOBILEPHONE,
+  WOOTHEE_CATEGORY_APPLIANCE,
+  WOOTHEE_CATEGORY_CRAWLER,
+  WOOTHEE_CATEGORY_MISC,
+  WOOTHEE_CATEGORY_UNKNOWN,
+  WOOTHEE_CATEGORY_SIZE
+};
+
+/*
+ * Per challenge rule counters filled by woothee_parse_profiled(), indexed
+ * by rule id (0 .. woothee_rule_size() - 1). The last id, "fastpath",
+ * counts the fast path tried before the challenges; its calls are the
+ * parses that reached it.
+ */
+typedef struct {
+  unsigned long long calls; /* times the challenge ran */
+  unsigned long long hits;  /* times it classified the useragent */
+  unsigned long long nsec;  /* time spent in it */
+  unsigned long long depth; /* challenges run before it, summed over hits */
+} woothee_rule_stat_t;
+
+/*
+ * Columns filled by woothee_parse_batch(), one entry per useragent of the
+ * batch unless noted. Free them with woothee_result_free().
+ */
+typedef struct {
+  size_t size;             /* useragents in the batch */
+  size_t unique;           /* distinct ones, each parsed once */
+  woothee_t **results;     /* [unique] their results, NULL for "-" */
+  unsigned int *id;        /* index into results */
+  unsigned char *category; /* WOOTHEE_CATEGORY_* */
+  short *name;             /* woothee_dataset_index() of the name or -1 */
+  int *version_major;      /* as in woothee_t, -1 where absent */
+  int *version_minor;
+} woothee_result_t;
+
+/*
+ * Adaptive challenge order for woothee_parse_adaptive(). It is updated by
+ * every parse using it, so it must not be shared between threads.
+ */
+typedef struct woothee_order_s woothee_order_t;
+
+woothee_t * woothee_create(void);
 void woothee_delete(woothee_t *self);
 
 woothee_t * woothee_parse(const char *useragent);
+woothee_t * woothee_parse_fields(const char *useragent, unsigned int fields);
 int woothee_is_crawler(const char *useragent);
+int woothee_maybe_crawler(const char *useragent);
+
+int woothee_parse_batch(const char *const *uas, const size_t *lens, size_t n,
+                        woothee_result_t *out);
+int woothee_parse_batch_threads(const char *const *uas, const size_t *lens,
+                                size_t n, woothee_result_t *out,
+                                int threads);
+void woothee_result_free(woothee_result_t *out);
+
+woothee_t * woothee_parse_profiled(const char *useragent,
+                                   woothee_rule_stat_t *stats);
+int woothee_rule_size(void);
+void woothee_rule_timing(int enable);
+void woothee_fastpath_enable(int enable);
+
+woothee_order_t * woothee_order_create(unsigned int period);
+void woothee_order_delete(woothee_order_t *order);
+woothee_t * woothee_parse_adaptive(const char *useragent,
+                                   woothee_order_t *order,
+                                   woothee_rule_stat_t *stats,
+                                   unsigned int fields);
+const char * woothee_rule_name(int id);
+
+int woothee_group_size(void);
+const char * woothee_group_name(int id);
+int woothee_group_index(const char *name);
+void woothee_groups_disable(unsigned int mask);
+
+int woothee_dataset_size(void);
+woothee_data_t * woothee_dataset_at(int index);
+int woothee_dataset_index(const char *name);
+
+int woothee_category_id(const char *category);
+const char * woothee_category_name(int id);
+
+int woothee_version_split(const char *version,
+                          int *major, int *minor, int *patch);
+void woothee_update_numbers(woothee_t *self);
 
 
 #endif